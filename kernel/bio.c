@@ -7,7 +7,8 @@
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bwrite_async and later bwait to overlap several writes.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -39,6 +40,7 @@ binit(void)
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  blkinit();
 
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
@@ -96,7 +98,8 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    blk_submit(b, 0);
+    blk_wait(b);
     b->valid = 1;
   }
   return b;
@@ -108,7 +111,27 @@ bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  blk_submit(b, 1);
+  blk_wait(b);
+}
+
+// Start writing b's contents to disk, without waiting.
+// b must stay locked until bwait(b).
+void
+bwrite_async(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_async");
+  blk_submit(b, 1);
+}
+
+// Wait for a bwrite_async() to finish.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  blk_wait(b);
 }
 
 // Release a locked buffer.
@@ -0,0 +1,142 @@
+// Block request queue, between the buffer cache and the disk
+// driver.
+//
+// bio.c hands requests to blk_submit() and waits for them with
+// blk_wait(). Pending requests are kept sorted by block number
+// and sent to the driver in elevator (C-SCAN) order, from the
+// block after the last one dispatched upward and then from the
+// lowest, with runs of adjacent blocks going the same direction
+// merged into one multi-block request.
+//
+// A process that calls blk_plug() holds its submissions back
+// until blk_unplug(), so that a batch of writes, such as the
+// log's installs, reaches the driver as long sorted runs.
+// Waiting for a request dispatches everything pending first.
+//
+// There is one disk, so there is one queue.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+
+struct {
+  struct spinlock lock;
+  struct buf *pending;  // not yet dispatched, sorted by blockno, through qnext
+  uint pos;             // block after the last one dispatched
+} blkq;
+
+void
+blkinit(void)
+{
+  initlock(&blkq.lock, "blkq");
+}
+
+// send every pending request to the driver.
+static void
+dispatch(void)
+{
+  struct buf *list, *b, **pp, *run;
+  int n;
+
+  acquire(&blkq.lock);
+  list = blkq.pending;
+  blkq.pending = 0;
+  if(list){
+    // rotate the sorted list to start at blkq.pos.
+    for(pp = &list; *pp && (*pp)->blockno < blkq.pos; pp = &(*pp)->qnext)
+      ;
+    if(*pp && pp != &list){
+      for(b = *pp; b->qnext; b = b->qnext)
+        ;
+      b->qnext = list;
+      list = *pp;
+      *pp = 0;
+    }
+    for(b = list; b->qnext; b = b->qnext)
+      ;
+    blkq.pos = b->blockno + 1;
+  }
+  release(&blkq.lock);
+
+  // the driver may sleep for free descriptors, so it is
+  // called without blkq.lock, which completions take.
+  while(list){
+    run = list;
+    n = 1;
+    for(b = run; b->qnext && n < MAXMERGE; b = b->qnext, n++){
+      struct buf *nb = b->qnext;
+      if(nb->dev != b->dev || nb->blockno != b->blockno + 1 || nb->write != b->write)
+        break;
+    }
+    list = b->qnext;
+    b->qnext = 0;
+    virtio_disk_submit(run, n, run->write);
+  }
+}
+
+// queue a read (write=0) or write of locked buffer b.
+void
+blk_submit(struct buf *b, int write)
+{
+  struct buf **pp;
+  struct proc *p = myproc();
+
+  b->write = write;
+  b->disk = 1;
+
+  acquire(&blkq.lock);
+  for(pp = &blkq.pending; *pp && (*pp)->blockno < b->blockno; pp = &(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+  release(&blkq.lock);
+
+  if(p == 0 || p->plug == 0)
+    dispatch();
+}
+
+// wait for the disk to finish with b.
+void
+blk_wait(struct buf *b)
+{
+  dispatch();
+  virtio_disk_poll(b);
+
+  acquire(&blkq.lock);
+  while(b->disk == 1)
+    sleep(b, &blkq.lock);
+  release(&blkq.lock);
+}
+
+// called by the driver when it has finished with b.
+void
+blk_done(struct buf *b)
+{
+  acquire(&blkq.lock);
+  b->disk = 0;
+  wakeup(b);
+  release(&blkq.lock);
+}
+
+void
+blk_plug(void)
+{
+  myproc()->plug++;
+}
+
+void
+blk_unplug(void)
+{
+  struct proc *p = myproc();
+
+  if(p->plug <= 0)
+    panic("blk_unplug");
+  if(--p->plug == 0)
+    dispatch();
+}
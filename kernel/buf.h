@@ -1,6 +1,9 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int poll;    // spin for the disk to finish, rather than sleep?
+  int write;   // pending request is a write?
+  struct buf *qnext; // blkq.c request queue; driver's multi-block requests
   uint dev;
   uint blockno;
   struct sleeplock lock;
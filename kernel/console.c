@@ -195,6 +195,10 @@ consoleintr(int c)
   acquire(&cons.lock);
 
   switch(c){
+  case C('S'):  // Print page allocator and object cache usage.
+    kmemdump();
+    slabdump();
+    break;
   case C('P'):  // Print process list.
     procdump();
     break;
@@ -2,6 +2,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -16,6 +17,16 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bwrite_async(struct buf*);
+void            bwait(struct buf*);
+
+// blkq.c
+void            blkinit(void);
+void            blk_submit(struct buf*, int);
+void            blk_wait(struct buf*);
+void            blk_done(struct buf*);
+void            blk_plug(void);
+void            blk_unplug(void);
 
 // console.c
 void            consoleinit(void);
@@ -62,15 +73,31 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
+void            kmemdump(void);
+void*           kalloc_zeroed(void);
+void*           kalloc_pages_zeroed(int);
+int             kzerofill(void);
 void            kinit(void);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            slabdump(void);
+int             slabreclaim(void);
+
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
-void            begin_op(void);
+void            begin_op(int);
+void            log_sync(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -100,6 +127,7 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(void (*)(void), char*);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
@@ -133,6 +161,9 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// strbench.c
+void            strbench(void);
+
 // syscall.c
 void            argint(int, int*);
 int             argstr(int, char*, int);
@@ -142,11 +173,15 @@ int             fetchaddr(uint64, uint64*);
 void            syscall();
 
 // trap.c
-extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+uint            getticks(void);
+uint64          uptimens(void);
+int             sleepuntil(uint64);
+void            clockidle(void);
+void            clockbusy(void);
 
 // uart.c
 void            uartinit(void);
@@ -166,13 +201,21 @@ uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
-void            uvmclear(pagetable_t, uint64);
+int             uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+pagetable_t     ukvmcreate(void);
+void            ukvmfree(pagetable_t);
+void            ukvmsync(pagetable_t, pagetable_t);
+void            asidinit(void);
+void            ukvmswitch(struct proc*);
+void            kvmswitch(void);
+uint64          uvmsatp(struct proc*);
+void            uvmflush(struct proc*);
 
 // plic.c
 void            plicinit(void);
@@ -182,7 +225,8 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int, int);
+void            virtio_disk_poll(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -33,7 +33,7 @@ exec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
-  begin_op();
+  begin_op(IPUTBLOCKS);
 
   if((ip = namei(path)) == 0){
     end_op();
@@ -86,7 +86,8 @@ exec(char *path, char **argv)
   if((sz1 = uvmalloc(pagetable, sz, sz + (USERSTACK+1)*PGSIZE, PTE_W)) == 0)
     goto bad;
   sz = sz1;
-  uvmclear(pagetable, sz-(USERSTACK+1)*PGSIZE); // 将段的数据 标识为用户态不可用。这个就是为用户态创建的 为啥不可用？？
+  if(uvmclear(pagetable, sz-(USERSTACK+1)*PGSIZE) < 0) // 将段的数据 标识为用户态不可用。这个就是为用户态创建的 为啥不可用？？
+    goto bad;
   sp = sz; // 空的栈 sp == 栈基址 , SP 向下
   stackbase = sp - USERSTACK*PGSIZE; // 得到用户态栈内存虚拟地址还是物理地址？？应该是虚拟地址。stackbase 是sp的最小值
 
@@ -137,6 +138,9 @@ exec(char *path, char **argv)
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;  // 这个页表s不会放到 MMU的寄存器中s
   p->sz = sz;
+  p->guard = sz - (USERSTACK+1)*PGSIZE;
+  ukvmsync(p->kpagetable, p->pagetable);
+  uvmflush(p);
   // 因为这行代码在内核态,用sret返回用户态的时候,会执行sepc寄存器的地址,也就是trapframe->epc的地址
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
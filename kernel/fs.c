@@ -43,6 +43,10 @@ fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  if(sb.version != FSVERSION)
+    panic("fsinit: unsupported file system version");
+  if(sb.bsize != BSIZE)
+    panic("fsinit: file system block size isn't BSIZE");
   initlog(dev, &sb);
 }
 
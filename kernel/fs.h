@@ -3,7 +3,9 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+#ifndef BSIZE
+#define BSIZE 1024  // block size; make BSIZE=4096 for 4 KB blocks
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -20,9 +22,15 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint flags;        // FS_* mount options
+  uint version;      // Must be FSVERSION
+  uint bsize;        // Block size, must be BSIZE
 };
 
 #define FSMAGIC 0x10203040
+#define FSVERSION 1  // circular checksummed log, flags and bsize fields
+
+#define FS_RELAXED 0x1  // end_op() doesn't commit; fsync() or the flusher does
 
 #define NDIRECT 12
 #define NINDIRECT (BSIZE / sizeof(uint))
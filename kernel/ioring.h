@@ -0,0 +1,40 @@
+// Batched system call submission ring, shared between a
+// process and the kernel through ordinary user memory.
+//
+// user space fills sq[sqtail % IORING_NENT] and advances sqtail;
+// ioenter() executes entries from sqhead, appends a completion
+// to cq[cqtail % IORING_NENT] for each, and advances sqhead
+// and cqtail. user space consumes completions from cqhead.
+// the indices run freely and wrap at 2^32.
+
+#define IORING_NENT 16   // entries in each ring
+
+#define IOSQE_PREVLEN 0x1  // use the previous entry's result as args[2];
+                           // if that result is <= 0, complete with it
+                           // without executing this entry.
+
+// submission queue entry.
+// op is SYS_read, SYS_write, SYS_open, SYS_close or SYS_fstat,
+// and args[] are that system call's arguments.
+struct iosqe {
+  int op;
+  int flags;           // IOSQE_*
+  uint64 args[3];
+  uint64 user_data;    // copied to the completion
+};
+
+// completion queue entry.
+struct iocqe {
+  uint64 user_data;
+  int res;             // the system call's return value
+  int pad;             // always 0; no hidden bytes in the ABI
+};
+
+struct ioring {
+  uint sqhead;         // next entry the kernel will execute
+  uint sqtail;         // next free submission slot
+  uint cqhead;         // next completion user space will read
+  uint cqtail;         // next free completion slot
+  struct iosqe sq[IORING_NENT];
+  struct iocqe cq[IORING_NENT];
+};
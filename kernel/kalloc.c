@@ -1,6 +1,7 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or physically contiguous runs of 2^order pages.
 
 #include "types.h"
 #include "param.h"
@@ -11,58 +12,221 @@
 
 void freerange(void *pa_start, void *pa_end);
 
-// 物理页面的分配就是个简单list。 linux 用的bubble系统
+// 物理页面的分配是一个buddy系统(linux 也用buddy系统):
+// a free block of order k is 2^k pages, aligned to its own
+// size relative to KERNBASE, so its buddy is found by flipping
+// one bit of its page number. freeing a block merges it with
+// its buddy, repeatedly, while the buddy is free and whole.
 
 // kernel的分配器地址开始位置
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+#define NPAGE      ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa)  (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PG2PA(pg)  (KERNBASE + (uint64)(pg) * PGSIZE)
+#define NOTFREE    0xff   // kmem.order[] of a page that doesn't start a free block
+
+// a free block; its first bytes hold the free list links.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run freelist[MAXORDER+1];  // circular lists of free blocks, by order
+  uint nfree[MAXORDER+1];           // blocks on each list
+  uchar order[NPAGE];               // order of the free block starting at each page
 } kmem;
 
+#define SUPERORDER 9  // a 2 MB superpage
+
+// pages already zeroed by idle harts, for kalloc_zeroed(),
+// and 2 MB blocks, for kalloc_pages_zeroed(SUPERORDER). a
+// 2 MB block is zeroed a page per kzerofill() call, so an
+// idle hart never spends long away from the run queue.
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+  struct run *super;  // zeroed 2 MB blocks
+  int nsuper;
+  char *fill;         // 2 MB block being zeroed
+  int fillnext;       // next page of fill to zero
+  int filldone;       // pages of fill zeroed
+} kzero;
+
+static void
+push(int k, struct run *r)
+{
+  r->next = kmem.freelist[k].next;
+  r->prev = &kmem.freelist[k];
+  r->next->prev = r;
+  kmem.freelist[k].next = r;
+  kmem.order[PA2PG(r)] = k;
+  kmem.nfree[k]++;
+}
+
+static void
+unlink(int k, struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.order[PA2PG(r)] = NOTFREE;
+  kmem.nfree[k]--;
+}
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&kzero.lock, "kzero");
+  for(int k = 0; k <= MAXORDER; k++)
+    kmem.freelist[k].next = kmem.freelist[k].prev = &kmem.freelist[k];
+  for(int i = 0; i < NPAGE; i++)
+    kmem.order[i] = NOTFREE;
   freerange(end, (void*)PHYSTOP);
 }
 
+// Add [pa_start, pa_end) to the free lists as the largest
+// aligned blocks that fit, without touching the pages;
+// kalloc_pages() splits them on demand.
 void
 freerange(void *pa_start, void *pa_end)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);// 4096 对齐
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  uint64 pg = PA2PG(PGROUNDUP((uint64)pa_start)); // 4096 对齐
+  uint64 top = PA2PG(PGROUNDDOWN((uint64)pa_end));
+  int k;
+
+  acquire(&kmem.lock);
+  while(pg < top){
+    for(k = MAXORDER; k > 0; k--)
+      if((pg & ((1L << k) - 1)) == 0 && pg + (1L << k) <= top)
+        break;
+    push(k, (struct run*)PG2PA(pg));
+    pg += 1L << k;
+  }
+  release(&kmem.lock);
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Free the 2^order pages of physical memory starting at pa,
+// which should have been returned by a call to
+// kalloc_pages(order).
 void
-kfree(void *pa)
+kfree_pages(void *pa, int order)
 {
-  struct run *r;
+  uint64 pg, buddy;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  if(order < 0 || order > MAXORDER)
+    panic("kfree_pages: order");
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end ||
+     (uint64)pa + (PGSIZE << order) > PHYSTOP ||
+     (PA2PG(pa) & ((1L << order) - 1)) != 0)
     panic("kfree");
 
+#ifdef KMEMDEBUG
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  pg = PA2PG(pa);
+  for(; order < MAXORDER; order++){
+    buddy = pg ^ (1L << order);
+    if(buddy >= NPAGE || kmem.order[buddy] != order)
+      break;
+    unlink(order, (struct run*)PG2PA(buddy));
+    if(buddy < pg)
+      pg = buddy;
+  }
+  push(order, (struct run*)PG2PA(pg));
+  release(&kmem.lock);
+}
 
-  r = (struct run*)pa; // 如果在freelist时候， page 的头 8个字节(uint64) 被用作run结构体。分配后，它就没用了。可以用来存数据形成完整的一页page
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns 0 if the memory cannot be allocated.
+void *
+kalloc_pages(int order)
+{
+  struct run *r;
+  int k;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.nfree[k] > 0)
+      break;
+  if(k > MAXORDER){
+    release(&kmem.lock);
+    return 0;
+  }
+  r = kmem.freelist[k].next;
+  unlink(k, r);
+  // split, returning the upper halves.
+  while(k > order){
+    k--;
+    push(k, (struct run*)((char*)r + (PGSIZE << k)));
+  }
   release(&kmem.lock);
+
+#ifdef KMEMDEBUG
+  memset((char*)r, 5, PGSIZE << order); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Free the page of physical memory pointed at by pa.
+void
+kfree(void *pa)
+{
+  kfree_pages(pa, 0);
+}
+
+// give the zeroed 2 MB blocks back to the buddy lists when
+// memory runs out. returns the number of blocks freed.
+static int
+kzerodrain(void)
+{
+  struct run *r, *list;
+  int n = 0;
+
+  acquire(&kzero.lock);
+  list = kzero.super;
+  kzero.super = 0;
+  kzero.nsuper = 0;
+  if(kzero.fill && kzero.filldone == kzero.fillnext){
+    // no hart is zeroing a page of it.
+    r = (struct run*)kzero.fill;
+    r->next = list;
+    list = r;
+    kzero.fill = 0;
+  }
+  release(&kzero.lock);
+
+  while((r = list) != 0){
+    list = r->next;
+    kfree_pages(r, SUPERORDER);
+    n++;
+  }
+  return n;
+}
+
+static void *
+kzeropop(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.list;
+  if(r){
+    kzero.list = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+  return (void*)r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,16 +234,153 @@ kfree(void *pa)
 // Returns 0 if the memory cannot be allocated.
 void *
 kalloc(void)
+{
+  void *pa;
+
+  if((pa = kalloc_pages(0)) == 0)
+    pa = kzeropop();
+  if(pa == 0 && (kzerodrain() + slabreclaim()) > 0){
+    // pooled 2 MB blocks, or empty slabs cached in this
+    // hart's magazines, went back.
+    if((pa = kalloc_pages(0)) == 0)
+      pa = kzeropop();
+  }
+  return pa;
+}
+
+// Allocate one page filled with zeros, from the pool
+// if an idle hart has prepared one.
+void *
+kalloc_zeroed(void)
+{
+  void *pa;
+
+  if((pa = kzeropop()) != 0){
+    ((struct run*)pa)->next = 0;
+    return pa;
+  }
+  if((pa = kalloc()) != 0)
+    memset(pa, 0, PGSIZE);
+  return pa;
+}
+
+// Allocate a block of 2^order pages filled with zeros. 2 MB
+// blocks come from the pool if idle harts have prepared one.
+void *
+kalloc_pages_zeroed(int order)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  if(order == 0)
+    return kalloc_zeroed();
+  if(order == SUPERORDER){
+    acquire(&kzero.lock);
+    if((r = kzero.super) != 0){
+      kzero.super = r->next;
+      kzero.nsuper--;
+    }
+    release(&kzero.lock);
+    if(r){
+      r->next = 0;
+      return r;
+    }
+  }
+  if((r = kalloc_pages(order)) != 0)
+    memset(r, 0, (uint64)PGSIZE << order);
+  return r;
+}
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
-  return (void*)r;
+// zero one page of the 2 MB block being filled, starting
+// one if the pool is short. returns 1 if it did.
+static int
+kzerosuper(void)
+{
+  char *b;
+  int i;
+
+  acquire(&kzero.lock);
+  if(kzero.fill == 0){
+    if(kzero.nsuper >= NZEROSUPER){
+      release(&kzero.lock);
+      return 0;
+    }
+    release(&kzero.lock);
+    if((b = kalloc_pages(SUPERORDER)) == 0)
+      return 0;
+    acquire(&kzero.lock);
+    if(kzero.fill || kzero.nsuper >= NZEROSUPER){
+      release(&kzero.lock);
+      kfree_pages(b, SUPERORDER);
+      return 0;
+    }
+    kzero.fill = b;
+    kzero.fillnext = kzero.filldone = 0;
+  }
+  if(kzero.fillnext == (1 << SUPERORDER)){
+    // other harts are zeroing the last pages.
+    release(&kzero.lock);
+    return 0;
+  }
+  b = kzero.fill;
+  i = kzero.fillnext++;
+  release(&kzero.lock);
+
+  memset(b + (uint64)i*PGSIZE, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  if(++kzero.filldone == (1 << SUPERORDER)){
+    ((struct run*)b)->next = kzero.super;
+    kzero.super = (struct run*)b;
+    kzero.nsuper++;
+    kzero.fill = 0;
+  }
+  release(&kzero.lock);
+  return 1;
+}
+
+// Called by the scheduler when it has nothing to run:
+// zero one free page into the pool, or one page of a 2 MB
+// block once the page pool is full.
+// Returns 1 if it did, 0 if there was nothing to do.
+int
+kzerofill(void)
+{
+  struct run *r;
+
+  if(__atomic_load_n(&kzero.n, __ATOMIC_RELAXED) >= NZEROPAGE)
+    return kzerosuper();
+  if((r = kalloc_pages(0)) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  if(kzero.n >= NZEROPAGE){
+    release(&kzero.lock);
+    kfree(r);
+    return 0;
+  }
+  r->next = kzero.list;  // the link word is cleared when handed out
+  kzero.list = r;
+  kzero.n++;
+  release(&kzero.lock);
+  return 1;
+}
+
+// print free blocks of each order.  For debugging.
+// No lock to avoid wedging a stuck machine further.
+void
+kmemdump(void)
+{
+  uint64 pages = 0;
+  int largest = -1;
+
+  printf("order\tfree blocks\n");
+  for(int k = 0; k <= MAXORDER; k++){
+    printf("%d\t%d\n", k, kmem.nfree[k]);
+    pages += (uint64)kmem.nfree[k] << k;
+    if(kmem.nfree[k])
+      largest = k;
+  }
+  printf("%ld free pages, largest free block order %d, %d zeroed pages, %d zeroed 2 MB blocks\n",
+         pages, largest, kzero.n, kzero.nsuper);
 }
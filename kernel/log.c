@@ -4,6 +4,7 @@
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 
@@ -16,25 +17,52 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() is told how many blocks the
+// call may write, and usually just reserves that much log
+// space and returns. But if the log is close to running out,
+// it sleeps until the last outstanding end_op() commits.
+// The log's size comes from the superblock, up to LOGSIZE.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
+//   header block, containing the ring position of the oldest
+//     logged block, and block #s and checksums for block A, B, C, ...
+//   a ring of log.size-1 slots holding block A, B, C, ...
 // Log appends are synchronous.
+//
+// On a file system with FS_RELAXED set, end_op() doesn't commit.
+// The transaction stays open, and later calls join it, until
+// log_sync() (for fsync()), a begin_op() that finds the log
+// full, or the flusher thread commits it.
+//
+// A commit writes its log blocks and the new header together,
+// in any order, and waits once for all of them. Recovery checks
+// the checksums of the newest transaction's log blocks, which
+// the header marks, and ignores that transaction if any block
+// didn't reach the disk.
+//
+// Committed blocks aren't written to their home locations
+// right away. Each commit appends its blocks to the ring after
+// those of earlier, uninstalled commits, and they stay pinned
+// in the buffer cache. A checkpoint writes the oldest logged
+// blocks home and frees their slots, skipping any block that
+// a later commit logged again, since that copy is installed
+// with the later one. So a hot block is written home once per
+// trip around the ring rather than once per commit.
+// When the next transaction might not fit, commit() checkpoints
+// the older half of the log. The flusher thread checkpoints all
+// of it once the oldest commit is FLUSHAGE ticks old.
+// Recovery installs the log in order, so the latest copy of a
+// block wins.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
+  int tail;        // ring slot of block[0]
+  int prev;        // block[0..prev) were durable before this header
   int block[LOGSIZE];
+  uint sum[LOGSIZE];  // logsum() of each logged block
 };
 
 struct log {
@@ -42,43 +70,92 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks they have reserved
+  int nbitmap;     // bitmap blocks, which one op may all write
+  int relaxed;     // FS_RELAXED: don't commit in end_op()
+  int syncing;     // log_sync() calls waiting; begin_op() admits no one
   int committing;  // in commit(), please wait.
   int dev;
+  int committed;   // lh.block[0..committed) are committed, not yet installed
+  uint since[LOGSIZE]; // getticks() when lh.block[i] committed
   struct logheader lh;
 };
 struct log log;
 
 static void recover_from_log(void);
+static void install_trans(int, int);
 static void commit();
+static void flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  // the disk writes a sector atomically, so a header in one
+  // sector can't be torn into halves from different commits.
+  if (sizeof(struct logheader) > 512)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.nbitmap = sb->size / BPB + 1;
+  log.relaxed = (sb->flags & FS_RELAXED) != 0;
+  if (log.size - 1 > LOGSIZE)
+    log.size = LOGSIZE + 1;
+  if (log.size - 1 < MAXOPBLOCKS + log.nbitmap)
+    panic("initlog: log too small");
   recover_from_log();
+  kthread(flusher, "flusher");
+}
+
+// Disk block holding log entry i.
+static int
+logblock(int i)
+{
+  return log.start + 1 + (log.lh.tail + i) % (log.size - 1);
 }
 
-// Copy committed blocks from log to their home location
+// Copy the oldest k logged blocks to their home location: from
+// the log when recovering, else from the pinned cache copies,
+// which hold the latest committed data since no transaction is
+// active. A block logged again later in the log is skipped;
+// the later entry installs it. The writes are queued together,
+// so that the disk sees them sorted and merged into runs.
 static void
-install_trans(int recovering)
+install_trans(int k, int recovering)
 {
-  int tail;
+  int tail, i, n = 0;
+  struct buf *dbufs[LOGSIZE];
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+  blk_plug();
+  for (tail = 0; tail < k; tail++) {
+    for (i = tail+1; i < log.lh.n; i++)
+      if (log.lh.block[i] == log.lh.block[tail])
+        break;
+    if (i < log.lh.n) {  // installed by the later entry
+      if(recovering == 0){
+        struct buf *b = bread(log.dev, log.lh.block[tail]);
+        bunpin(b);
+        brelse(b);
+      }
+      continue;
+    }
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+    if(recovering){
+      struct buf *lbuf = bread(log.dev, logblock(tail)); // read log block
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    bwrite_async(dbuf);  // write dst to disk
+    dbufs[n++] = dbuf;
+  }
+  blk_unplug();
+  for (i = 0; i < n; i++) {
+    bwait(dbufs[i]);
     if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+      bunpin(dbufs[i]);
+    brelse(dbufs[i]);
   }
 }
 
@@ -90,51 +167,144 @@ read_head(void)
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
   log.lh.n = lh->n;
+  log.lh.tail = lh->tail;
+  log.lh.prev = lh->prev;
   for (i = 0; i < log.lh.n; i++) {
     log.lh.block[i] = lh->block[i];
+    log.lh.sum[i] = lh->sum[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Copy the in-memory log header into the header block.
+// block[0..log.committed) are already on disk.
 static void
-write_head(void)
+fill_head(struct buf *buf)
 {
-  struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
   hb->n = log.lh.n;
+  hb->tail = log.lh.tail;
+  hb->prev = log.committed;
   for (i = 0; i < log.lh.n; i++) {
     hb->block[i] = log.lh.block[i];
+    hb->sum[i] = log.lh.sum[i];
   }
+}
+
+// Write in-memory log header to disk.
+static void
+write_head(void)
+{
+  struct buf *buf = bread(log.dev, log.start);
+  fill_head(buf);
+  buf->poll = 1;
   bwrite(buf);
+  buf->poll = 0;
   brelse(buf);
 }
 
+// FNV-1a over the words of a log block.
+static uint
+logsum(uchar *data)
+{
+  uint *w = (uint *) data;
+  uint h = 2166136261;
+  int i;
+
+  for (i = 0; i < BSIZE / sizeof(uint); i++)
+    h = (h ^ w[i]) * 16777619;
+  return h;
+}
+
+// Drop the newest transaction if any of its log blocks
+// doesn't match its checksum: its header reached the disk
+// but the crash came before all of its blocks did.
+static void
+check_log(void)
+{
+  int i;
+
+  for (i = log.lh.prev; i < log.lh.n; i++) {
+    struct buf *lbuf = bread(log.dev, logblock(i));
+    uint sum = logsum(lbuf->data);
+    brelse(lbuf);
+    if (sum != log.lh.sum[i]) {
+      printf("log: discarding torn transaction of %d blocks\n", log.lh.n - log.lh.prev);
+      log.lh.n = log.lh.prev;
+      break;
+    }
+  }
+}
+
 static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
+  if (log.lh.n > log.size - 1 || log.lh.tail < 0 || log.lh.tail >= log.size - 1 ||
+      log.lh.prev < 0 || log.lh.prev > log.lh.n)
+    panic("recover_from_log: bad log header");
+  check_log();
+  install_trans(log.lh.n, 1); // if committed, copy from log to disk
   log.lh.n = 0;
+  log.lh.tail = 0;
+  log.committed = 0;
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// Install the oldest k committed blocks and free their slots.
+// Caller has set log.committing, so no transaction is active.
+static void
+checkpoint(int k)
+{
+  if (k > 0) {
+    install_trans(k, 0);
+    memmove(log.lh.block, log.lh.block + k, (log.lh.n - k) * sizeof(int));
+    memmove(log.lh.sum, log.lh.sum + k, (log.lh.n - k) * sizeof(uint));
+    memmove(log.since, log.since + k, (log.lh.n - k) * sizeof(uint));
+    log.lh.tail = (log.lh.tail + k) % (log.size - 1);
+    log.lh.n -= k;
+    log.committed -= k;
+    write_head();    // Erase those blocks from the log
+  }
+}
+
+// called at the start of each FS system call, which may write
+// at most nblocks blocks, counting the bitmap as one.
 void
-begin_op(void)
+begin_op(int nblocks)
 {
+  struct proc *p = myproc();
+
+  // freeing blocks may touch every bitmap block.
+  nblocks += log.nbitmap - 1;
+  if(nblocks > MAXOPBLOCKS + log.nbitmap - 1)
+    panic("begin_op");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    if(log.committing || log.syncing){
+      // a commit is under way, or log_sync() is waiting for
+      // the open transaction to drain so that it can commit.
       sleep(&log, &log.lock);
+    } else if(log.lh.n + log.reserved + nblocks > log.size - 1){
+      if(log.outstanding == 0){
+        // an open transaction of a relaxed log; commit it
+        // to make room.
+        log.committing = 1;
+        release(&log.lock);
+        commit();
+        acquire(&log.lock);
+        log.committing = 0;
+        wakeup(&log);
+      } else {
+        // this op might exhaust log space; wait for commit.
+        sleep(&log, &log.lock);
+      }
     } else {
       log.outstanding += 1;
+      log.reserved += nblocks;
+      p->logres = nblocks;
       release(&log.lock);
       break;
     }
@@ -150,15 +320,18 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= myproc()->logres;
+  myproc()->logres = 0;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
+  if(log.outstanding == 0 && !log.relaxed){
     do_commit = 1;
     log.committing = 1;
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
+    // the amount of reserved space. log_sync() may be
+    // waiting for outstanding to reach 0.
     wakeup(&log);
   }
   release(&log.lock);
@@ -174,31 +347,126 @@ end_op(void)
   }
 }
 
-// Copy modified blocks from cache to log.
+// Commit the FS calls that have finished, for fsync().
+// Returns at once if none are waiting to be committed, as on
+// a strict log with no calls in progress. Otherwise it waits
+// for the calls in progress, and begin_op() holds new ones
+// back meanwhile, so the wait is bounded. On a strict log the
+// last of them commits in end_op(); on a relaxed log this does.
+void
+log_sync(void)
+{
+  acquire(&log.lock);
+  if(!log.committing && log.lh.n == log.committed){
+    release(&log.lock);
+    return;
+  }
+  log.syncing++;
+  while(log.committing || log.outstanding > 0)
+    sleep(&log, &log.lock);
+  log.syncing--;
+  if(log.lh.n == log.committed){
+    wakeup(&log);  // begin_op() may be waiting on syncing
+    release(&log.lock);
+    return;
+  }
+  log.committing = 1;
+  release(&log.lock);
+
+  commit();
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Copy the current transaction's modified blocks from cache
+// to log, after those of earlier commits, and write the header
+// along with the last of them -- the real commit. The blocks
+// go out MAXMERGE at a time, so as not to tie up the cache.
 static void
 write_log(void)
 {
-  int tail;
+  int tail, i, n;
+  struct buf *bufs[MAXMERGE+1];
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = log.committed; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > MAXMERGE)
+      n = MAXMERGE;
+    blk_plug();
+    for (i = 0; i < n; i++) {
+      struct buf *to = bread(log.dev, logblock(tail+i)); // log block
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to->data, from->data, BSIZE);
+      brelse(from);
+      log.lh.sum[tail+i] = logsum(to->data);
+      bufs[i] = to;
+    }
+    if (tail + n == log.lh.n) {
+      bufs[n] = bread(log.dev, log.start);
+      fill_head(bufs[n++]);
+    }
+    for (i = 0; i < n; i++) {
+      bufs[i]->poll = 1;  // on the commit path; don't wait for an interrupt
+      bwrite_async(bufs[i]);
+    }
+    blk_unplug();
+    for (i = 0; i < n; i++) {
+      bwait(bufs[i]);
+      bufs[i]->poll = 0;
+      brelse(bufs[i]);
+    }
   }
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  if (log.lh.n > log.committed) {
+    write_log();     // Write modified blocks and header to log
+    for (int i = log.committed; i < log.lh.n; i++)
+      log.since[i] = getticks();
+    log.committed = log.lh.n;
+  }
+  // Make room if the next transaction might not fit, or
+  // install now if writes aren't being deferred.
+  if (FLUSHAGE == 0)
+    checkpoint(log.committed);
+  else if (log.committed + MAXOPBLOCKS + log.nbitmap - 1 > log.size - 1) {
+    int k = log.committed + MAXOPBLOCKS + log.nbitmap - 1 - (log.size - 1);
+    checkpoint(k > log.committed / 2 ? k : log.committed / 2);
+  }
+}
+
+// Kernel thread that, while no FS call is active, commits a
+// relaxed log's open transaction, and checkpoints the log once
+// its oldest commit is FLUSHAGE ticks old.
+static void
+flusher(void)
+{
+  for(;;){
+    sleepuntil(r_time() + (uint64)(FLUSHAGE/2 + 1) * TICKINTERVAL);
+
+    acquire(&log.lock);
+    if (log.lh.n == 0 || log.committing || log.outstanding > 0) {
+      release(&log.lock);
+      continue;
+    }
+    log.committing = 1;
+    release(&log.lock);
+
+    // commit first: a checkpoint installs the cached blocks,
+    // which must not hold uncommitted changes.
+    commit();
+    if (log.committed > 0 && getticks() - log.since[0] >= FLUSHAGE)
+      checkpoint(log.committed);
+
+    acquire(&log.lock);
+    log.committing = 0;
+    wakeup(&log);
+    release(&log.lock);
   }
 }
 
@@ -222,7 +490,7 @@ log_write(struct buf *b)
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
+  for (i = log.committed; i < log.lh.n; i++) {
     if (log.lh.block[i] == b->blockno)   // log absorption
       break;
   }
@@ -19,8 +19,13 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // object caches for sub-page objects
+#ifdef STRBENCH
+    strbench();      // string routine throughput
+#endif
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging  // 为什么这之后的uvmcopy 内核态还需要获取物理地址才能操作
+    asidinit();      // address-space identifiers
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector   // 注册kernel trap处理入口
@@ -29,6 +34,7 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe cache
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
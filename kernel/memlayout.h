@@ -21,6 +21,9 @@
 #define UART0 0x10000000L
 #define UART0_IRQ 10
 
+// qemu's time CSR (the CLINT mtime) runs at 10 MHz.
+#define TIMEBASE 10000000L
+
 // virtio mmio interface
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
@@ -33,6 +36,11 @@
 #define PLIC_SPRIORITY(hart) (PLIC + 0x201000 + (hart)*0x2000)
 #define PLIC_SCLAIM(hart) (PLIC + 0x201004 + (hart)*0x2000)
 
+// user memory below UKVMTOP is also mapped in each process's
+// kernel page table (see ukvmcreate() in vm.c), so that copyin()
+// and copyout() can reach it directly.
+#define UKVMTOP PLIC
+
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
 // from physical address 0x80000000 to PHYSTOP.
@@ -54,10 +62,24 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   USYSCALL (p->usyscall, read-only, shared with the kernel)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)   // 这个地址只在进程的用户态的时候有，其他情况下没有这个东西
 
+// a read-only page just below the trapframe, which the kernel
+// fills in so that user space can read its pid and the clock
+// without a system call (see ugetpid() in user/ulib.c).
+#define USYSCALL (TRAPFRAME - PGSIZE)
+
+#ifndef __ASSEMBLER__
+struct usyscall {
+  int pid;            // Process ID
+  uint64 timebase;    // frequency of the time CSR (TIMEBASE)
+  uint64 tickcycles;  // time CSR cycles per tick (TICKINTERVAL)
+};
+#endif
+
 
 // 用户进程的布局 虚拟地址：User memory layout.  【每个用户进程的虚拟地址】
 // Address zero first:
@@ -66,6 +88,7 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   USYSCALL (p->usyscall, read-only, shared with the kernel)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 
@@ -7,9 +7,20 @@
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define CREATEBLOCKS  6  // blocks create() may write, counting one bitmap block
+#define LINKBLOCKS    5  // blocks link() may write
+#define UNLINKBLOCKS  4  // blocks unlink() may write
+#define IPUTBLOCKS    2  // blocks freeing an unlinked inode may write
+#define LOGSIZE      (MAXOPBLOCKS*6)  // max data blocks in on-disk log; header must fit one sector
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // size of disk block cache, room for LOGSIZE pinned
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define MAXORDER     10    // largest kalloc_pages() block is 2^MAXORDER pages
+#define NZEROPAGE    64    // pre-zeroed pages kept for kalloc_zeroed()
+#define NZEROSUPER   2     // pre-zeroed 2 MB blocks kept for kalloc_pages_zeroed()
+#define SLABIDLE     10    // idle ticks before a hart empties its slab magazines
+#define MAXMERGE     16    // most blocks merged into one disk request
+#define TICKINTERVAL 1000000 // timer cycles per clock tick, about 1/10th second
+#define FLUSHAGE     30    // ticks a commit may wait before install; 0 installs at once
 
@@ -16,6 +16,7 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadstart(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -109,11 +110,11 @@ allocpid()
 }
 
 // Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// If found, give it a pid and a context that starts
+// executing at forkret on its kernel stack, and return
+// with p->lock held. Otherwise return 0.
 static struct proc*
-allocproc(void)
+allocslot(void)
 {
   struct proc *p;
 
@@ -131,21 +132,6 @@ found:
   p->pid = allocpid();
   p->state = USED;
 
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
-
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);  // pagetable  但是这个函数会为trampoline和trapframe映射虚拟地址
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
-
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -173,6 +159,56 @@ found:
   return p;
 }
 
+// Allocate a proc for a user process: a slot from
+// allocslot(), plus what it needs to run in user space.
+// Return with p->lock held.
+// If there are no free procs, or a memory allocation fails, return 0.
+static struct proc*
+allocproc(void)
+{
+  struct proc *p;
+
+  if((p = allocslot()) == 0)
+    return 0;
+
+  // Allocate a trapframe page.
+  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
+  // Allocate the page that user space reads instead of
+  // making getpid() and uptime() system calls.
+  if((p->usyscall = (struct usyscall *)kalloc_zeroed()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+  p->usyscall->pid = p->pid;
+  p->usyscall->timebase = TIMEBASE;
+  p->usyscall->tickcycles = TICKINTERVAL;
+
+  // An empty user page table.
+  p->pagetable = proc_pagetable(p);  // pagetable  但是这个函数会为trampoline和trapframe映射虚拟地址
+  if(p->pagetable == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
+  // The kernel page table to run on while p is current,
+  // which can also reach p's user memory.
+  if((p->kpagetable = ukvmcreate()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+  p->guard = 0;
+
+  return p;
+}
+
 // free a proc structure and the data hanging from it,
 // including user pages.
 // p->lock must be held.
@@ -182,6 +218,15 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  if(p->usyscall)
+    kfree((void*)p->usyscall);
+  p->usyscall = 0;
+  if(p->kpagetable)
+    ukvmfree(p->kpagetable);
+  p->kpagetable = 0;
+  p->asid = 0;
+  p->tlbharts = 0;
+  p->kfn = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
@@ -228,6 +273,16 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the usyscall page just below the trapframe, readable
+  // (but not writable) from user space.
+  if(mappages(pagetable, USYSCALL, PGSIZE,
+              (uint64)(p->usyscall), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -238,6 +293,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, USYSCALL, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -267,6 +323,7 @@ userinit(void)
   // and data into it.
   uvmfirst(p->pagetable, initcode, sizeof(initcode));
   p->sz = PGSIZE;
+  ukvmsync(p->kpagetable, p->pagetable);
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter //返回用户态的时候就会执行从epc开始的指令
@@ -280,6 +337,24 @@ userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel thread that runs fn(), which must not return.
+// It never enters user space, so it gets only a kernel stack
+// and a context, and runs on kernel_pagetable; but it does
+// occupy one of the NPROC process slots.
+void
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocslot()) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -297,6 +372,8 @@ growproc(int n)
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
   p->sz = sz;
+  ukvmsync(p->kpagetable, p->pagetable);
+  uvmflush(p);
   return 0;
 }
 
@@ -321,6 +398,8 @@ fork(void)
     return -1;
   }
   np->sz = p->sz;
+  np->guard = p->guard;
+  ukvmsync(np->kpagetable, np->pagetable);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -390,7 +469,7 @@ exit(int status)
     }
   }
 
-  begin_op();
+  begin_op(IPUTBLOCKS);
   iput(p->cwd);
   end_op();
   p->cwd = 0;
@@ -510,6 +589,8 @@ scheduler(void)
 
 // 在XV6中，死锁是通过禁止在线程切换的时候加锁来避免的。
 // XV6禁止在调用switch函数时，获取除了p->lock以外的其他锁。如果你查看sched函数的代码，里面包含了一些检查代码来确保除了p->lock以外线程不持有其他锁。所以上面会产生死锁的代码在XV6中是不合法的并被禁止的。
+    // the scheduler never touches user memory.
+    w_sstatus(r_sstatus() & ~SSTATUS_SUM);
     intr_on();
 
     int found = 0;
@@ -527,6 +608,11 @@ scheduler(void)
         // before jumping back to us.
         p->state = RUNNING;
         c->proc = p;  // 唯一给proc赋有效值的地方
+        clockbusy();  // the process must be preemptible again
+
+        // run on p's kernel page table, which also maps
+        // its user memory for copyin() and copyout().
+        ukvmswitch(p);
 
         // 注意第一次执行进程的时候ra 是 forkret，forkret 会调用usertrapret 返回用户空间
 
@@ -540,13 +626,28 @@ scheduler(void)
         // Process is done running for now.
         // It should have changed its p->state before coming back.
         // schd()函数回到这里
+        kvmswitch();
         c->proc = 0;  
+        c->idle = 0;
         found = 1;
       }
       release(&p->lock);  // 跨进程（也可能是本进程）释放yield 里面获取的锁， 因为swtch换了执行路径等schd()函数回来 p已经换了
     }
     if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
+      // nothing to run; zero a page for kalloc_zeroed() if the
+      // pool is short, or, once this hart has been idle for
+      // SLABIDLE ticks, give its cached slab objects back, else
+      // stop running on this core until an interrupt.
+      if(!c->idle){
+        c->idle = 1;
+        c->idlesince = getticks();
+      }
+      if(kzerofill() ||
+         (getticks() - c->idlesince >= SLABIDLE && slabreclaim()))
+        continue;
+      // tickless idle: don't take periodic timer interrupts, only
+      // one for the next sleep() deadline (or a device interrupt).
+      clockidle();
       intr_on();
       asm volatile("wfi");  // 提示cpu可以进入低功耗状态
     }
@@ -662,6 +763,18 @@ forkret(void)
   usertrapret(); // 注册用户态的异常处理:w_stvec(trampoline_uservec); 
 }
 
+// A kernel thread's first scheduling swtch()es here.
+static void
+kthreadstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 // 放弃当前进程的执行
@@ -722,6 +835,10 @@ kill(int pid)
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
+    if(p->pid == pid && p->kfn){
+      release(&p->lock);
+      return -1;   // kernel threads can't be killed
+    }
     if(p->pid == pid){
       p->killed = 1;
       if(p->state == SLEEPING){
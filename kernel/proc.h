@@ -27,6 +27,9 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().  存储被切换出去的进程上下文
   int noff;                   // Depth of push_off() nesting. 嵌套关中断的次数
   int intena;                 // Were interrupts enabled before push_off()?   // = 1，说明在push_off之前 中断在启用状态
+  uint64 asidgen;             // ASID generation this hart's TLB was flushed for
+  int idle;                   // found nothing to run on the last scheduler pass
+  uint idlesince;             // ticks when idle was set
 };
 
 extern struct cpu cpus[NCPU];
@@ -104,11 +107,19 @@ struct proc {
   uint64 sz;                   // Size of process memory (bytes)
 
   // pagetable 内核中它是物理地址 但是va==pa
+  pagetable_t kpagetable;      // Kernel page table that also maps user memory below UKVMTOP
+  uint64 guard;                // User va of the stack guard page, or 0
+  uint64 asid;                 // ASID generation and number of pagetable; kpagetable uses asid+1
+  uint64 tlbharts;             // Harts whose TLBs may hold entries for asid
+  int plug;                    // blk_plug() depth; disk requests held back while > 0
+  int logres;                  // Log blocks reserved by begin_op()
+  void (*kfn)(void);           // If non-zero, a kernel thread running kfn()
   pagetable_t pagetable;       // User page table  // 每个进程有自己的独立页表。 有自己独立的用户栈（exec的时候创建）和独立的内核栈（内核初始化的时候创建proc_mapstacks）
   // trapframe是物理地址 它也有有用户态（user）虚拟地址  trampoline 也有用户态虚拟地址 也有物理地址
   // 进程的p->trapframe也指向trapframe，不过是指向它的物理地址（来自kalloc分配）会映射到虚拟地址TRAPFRAME，
   // 这样内核可以通过内核页表来使用它。
   struct trapframe *trapframe; // data page for trampoline.S
+  struct usyscall *usyscall;   // page shared read-only with user space
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -123,6 +134,7 @@ struct proc {
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   USYSCALL (p->usyscall, read-only, shared with the kernel)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 
@@ -0,0 +1,239 @@
+// Slab allocator for kernel objects smaller than a page,
+// layered on kalloc(). Each cache hands out objects of one
+// size, carved from whole pages; a per-CPU magazine of free
+// objects in front of each cache serves most allocations
+// and frees without taking the cache's lock.
+//
+// Only its own hart touches a magazine, so slabreclaim(),
+// which empties magazines so that empty slabs go back to
+// kalloc(), works on the calling hart's magazines. A hart
+// idle for SLABIDLE ticks calls it from the scheduler, and
+// kalloc() calls it when it runs out of pages.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "slab.h"
+#include "defs.h"
+
+struct run {
+  struct run *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} kcaches;
+
+void
+slabinit(void)
+{
+  initlock(&kcaches.lock, "kcaches");
+}
+
+// create a cache of objects of size bytes.
+// caches are never destroyed.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(size == 0 || size > PGSIZE - sizeof(struct slab))
+    panic("kmem_cache_create: size");
+
+  acquire(&kcaches.lock);
+  if(kcaches.n >= NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &kcaches.cache[kcaches.n++];
+  release(&kcaches.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / size;
+  return c;
+}
+
+// take an object from a slab of c, allocating a new slab
+// if none has a free object. caller holds c->lock, which
+// is dropped around kalloc(): when memory runs out, kalloc()
+// calls slabreclaim(), which takes every cache's lock.
+static void*
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s;
+  struct run *r;
+  char *p;
+
+  if(c->partial == 0){
+    release(&c->lock);
+    s = (struct slab*)kalloc();
+    acquire(&c->lock);
+    if(s && c->partial){
+      // another hart added a slab meanwhile.
+      kfree((void*)s);
+    } else if(s){
+      s->cache = c;
+      s->inuse = 0;
+      s->free = 0;
+      p = (char*)(s + 1);
+      for(int i = 0; i < c->perslab; i++, p += c->size){
+        r = (struct run*)p;
+        r->next = s->free;
+        s->free = r;
+      }
+      s->next = 0;
+      c->partial = s;
+      c->nslab++;
+    }
+  }
+  if((s = c->partial) == 0)
+    return 0;
+
+  r = s->free;
+  s->free = r->next;
+  s->inuse++;
+  if(s->free == 0){
+    // move s from partial to full.
+    c->partial = s->next;
+    s->next = c->full;
+    c->full = s;
+  }
+  c->nalloc++;
+  return (void*)r;
+}
+
+static void
+unlink_slab(struct slab **list, struct slab *s)
+{
+  for(; *list; list = &(*list)->next){
+    if(*list == s){
+      *list = s->next;
+      return;
+    }
+  }
+  panic("slab: unlink");
+}
+
+// return obj to its slab, and the slab to kalloc()
+// if it becomes empty. caller holds c->lock.
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+  struct run *r = (struct run*)obj;
+
+  if(s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+
+  if(s->free == 0){
+    // s was full.
+    unlink_slab(&c->full, s);
+    s->next = c->partial;
+    c->partial = s;
+  }
+  r->next = s->free;
+  s->free = r;
+  s->inuse--;
+  c->nfree++;
+
+  if(s->inuse == 0){
+    unlink_slab(&c->partial, s);
+    c->nslab--;
+    kfree((void*)s);
+  }
+}
+
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n > 0){
+    obj = m->obj[--m->n];
+    pop_off();
+    return obj;
+  }
+
+  // refill half the magazine while we hold the lock.
+  acquire(&c->lock);
+  obj = slab_get(c);
+  while(obj && m->n < MAGSIZE/2){
+    void *o = slab_get(c);
+    if(o == 0)
+      break;
+    m->obj[m->n++] = o;
+  }
+  release(&c->lock);
+  pop_off();
+  return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    // flush half the magazine back to the slabs.
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      slab_put(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  pop_off();
+}
+
+// return the objects in this hart's magazines to their
+// slabs, which frees the slabs that become empty. callers
+// hold no cache lock; slab_get() drops its lock around
+// kalloc(). returns the number of objects moved.
+int
+slabreclaim(void)
+{
+  struct kmem_cache *c;
+  struct magazine *m;
+  int n = 0;
+
+  push_off();
+  for(c = kcaches.cache; c < kcaches.cache + kcaches.n; c++){
+    m = &c->mag[cpuid()];
+    if(m->n == 0)
+      continue;
+    acquire(&c->lock);
+    while(m->n > 0){
+      slab_put(c, m->obj[--m->n]);
+      n++;
+    }
+    release(&c->lock);
+  }
+  pop_off();
+  return n;
+}
+
+// print per-cache usage.  For debugging.
+// No lock to avoid wedging a stuck machine further.
+void
+slabdump(void)
+{
+  struct kmem_cache *c;
+  uint inuse;
+
+  printf("cache\tsize\tperslab\tslabs\tinuse\n");
+  for(c = kcaches.cache; c < kcaches.cache + kcaches.n; c++){
+    inuse = c->nalloc - c->nfree;
+    for(int i = 0; i < NCPU; i++)
+      inuse -= c->mag[i].n;
+    printf("%s\t%d\t%d\t%d\t%d\n", c->name, c->size, c->perslab, c->nslab, inuse);
+  }
+}
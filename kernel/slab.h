@@ -0,0 +1,35 @@
+// Object caches for sub-page kernel objects (slab allocator).
+
+#define NCACHE   16   // maximum number of object caches
+#define MAGSIZE   8   // objects in each per-CPU magazine
+
+// a page carved into objects of one cache.
+// the header sits at the start of the page.
+struct slab {
+  struct slab *next;
+  struct kmem_cache *cache;
+  struct run *free;        // free objects in this slab
+  uint inuse;              // objects handed out (or in a magazine)
+};
+
+// per-CPU stack of free objects, so that most allocs
+// and frees take neither the cache lock nor a slab.
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;               // object size, rounded up to 8 bytes
+  uint perslab;            // objects per slab
+  struct slab *partial;    // slabs with free objects
+  struct slab *full;       // slabs without
+  struct magazine mag[NCPU];
+
+  // statistics, protected by lock.
+  uint nslab;              // slabs (pages) held
+  uint64 nalloc;           // kmem_cache_alloc() calls that reached a slab
+  uint64 nfree;            // objects returned to a slab
+};
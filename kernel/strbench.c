@@ -0,0 +1,106 @@
+// Boot-time self-benchmark of the string routines.
+// Built with make STRBENCH=1, main() calls strbench() on hart 0
+// once the page allocator is up, and it prints the bytes per
+// cycle of memset, memmove and memcmp against the plain byte
+// loops they replaced, for a few sizes and alignments.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NROUND 64   // repetitions of each measurement
+
+static void*
+bytememset(void *dst, int c, uint n)
+{
+  volatile char *cdst = (char *) dst;
+  for(uint i = 0; i < n; i++)
+    cdst[i] = c;
+  return dst;
+}
+
+static void*
+bytememmove(void *dst, const void *src, uint n)
+{
+  const char *s = src;
+  volatile char *d = dst;
+  while(n-- > 0)
+    *d++ = *s++;
+  return dst;
+}
+
+static int
+bytememcmp(const void *v1, const void *v2, uint n)
+{
+  const volatile uchar *s1 = v1, *s2 = v2;
+  while(n-- > 0){
+    if(*s1 != *s2)
+      return *s1 - *s2;
+    s1++, s2++;
+  }
+  return 0;
+}
+
+// print bytes/cycle as a fixed-point number with 2 decimals.
+static void
+report(char *name, uint n, int off, uint64 cycles)
+{
+  uint64 bpc;
+
+  if(cycles == 0)
+    cycles = 1;
+  bpc = (uint64)n * NROUND * 100 / cycles;
+  printf("  %s\t%d\t+%d\t%ld.%ld%ld bytes/cycle\n", name, n, off,
+         bpc / 100, (bpc / 10) % 10, bpc % 10);
+}
+
+void
+strbench(void)
+{
+  static uint sizes[] = { 16, 64, 512, PGSIZE - 8 };
+  static int offs[] = { 0, 3 };
+  char *a, *b;
+  uint64 t;
+
+  if((a = kalloc()) == 0 || (b = kalloc()) == 0)
+    panic("strbench: kalloc");
+
+  printf("strbench: routine size offset throughput\n");
+  for(int i = 0; i < NELEM(sizes); i++){
+    for(int j = 0; j < NELEM(offs); j++){
+      uint n = sizes[i];
+      int off = offs[j];
+
+      t = r_cycle();
+      for(int r = 0; r < NROUND; r++)
+        bytememset(a + off, r, n);
+      report("bytememset", n, off, r_cycle() - t);
+      t = r_cycle();
+      for(int r = 0; r < NROUND; r++)
+        memset(a + off, r, n);
+      report("memset", n, off, r_cycle() - t);
+
+      t = r_cycle();
+      for(int r = 0; r < NROUND; r++)
+        bytememmove(b + off, a + off, n);
+      report("bytememmove", n, off, r_cycle() - t);
+      t = r_cycle();
+      for(int r = 0; r < NROUND; r++)
+        memmove(b + off, a + off, n);
+      report("memmove", n, off, r_cycle() - t);
+
+      t = r_cycle();
+      for(int r = 0; r < NROUND; r++)
+        bytememcmp(a + off, b + off, n);
+      report("bytememcmp", n, off, r_cycle() - t);
+      t = r_cycle();
+      for(int r = 0; r < NROUND; r++)
+        memcmp(a + off, b + off, n);
+      report("memcmp", n, off, r_cycle() - t);
+    }
+  }
+
+  kfree(a);
+  kfree(b);
+}
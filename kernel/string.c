@@ -1,13 +1,40 @@
 #include "types.h"
 
+// memset, memcmp and memmove work a uint64 at a time, and
+// 64 bytes (one cache line) per loop iteration, once dst
+// (and src) are 8-byte aligned. they fall back to bytes when
+// dst and src can't both be aligned, since misaligned loads
+// and stores may trap on real hardware.
+
+#define WSIZE     ((int)sizeof(uint64))
+#define WALIGNED(p) (((uint64)(p) & (WSIZE-1)) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uchar *cdst = (uchar *) dst;
+  uint64 *wdst, w;
+
+  while(n > 0 && !WALIGNED(cdst)){
+    *cdst++ = c;
+    n--;
+  }
+
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wdst = (uint64 *) cdst;
+  for(; n >= 8*WSIZE; n -= 8*WSIZE, wdst += 8){
+    wdst[0] = w; wdst[1] = w; wdst[2] = w; wdst[3] = w;
+    wdst[4] = w; wdst[5] = w; wdst[6] = w; wdst[7] = w;
   }
+  for(; n >= WSIZE; n -= WSIZE)
+    *wdst++ = w;
+
+  cdst = (uchar *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +45,16 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if(((uint64)s1 & (WSIZE-1)) == ((uint64)s2 & (WSIZE-1))){
+    while(n > 0 && !WALIGNED(s1)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip equal words; the bytes loop finds the difference.
+    while(n >= WSIZE && *(uint64 *)s1 == *(uint64 *)s2)
+      s1 += WSIZE, s2 += WSIZE, n -= WSIZE;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -32,20 +69,58 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  const uint64 *ws;
+  uint64 *wd;
+  int words;
 
   if(n == 0)
     return dst;
   
   s = src;
   d = dst;
+  words = ((uint64)s & (WSIZE-1)) == ((uint64)d & (WSIZE-1));
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(words){
+      while(n > 0 && !WALIGNED(d)){
+        *--d = *--s;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 8*WSIZE; n -= 8*WSIZE){
+        ws -= 8, wd -= 8;
+        wd[7] = ws[7]; wd[6] = ws[6]; wd[5] = ws[5]; wd[4] = ws[4];
+        wd[3] = ws[3]; wd[2] = ws[2]; wd[1] = ws[1]; wd[0] = ws[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(words){
+      while(n > 0 && !WALIGNED(d)){
+        *d++ = *s++;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 8*WSIZE; n -= 8*WSIZE, ws += 8, wd += 8){
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
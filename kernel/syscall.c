@@ -121,6 +121,10 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_uptimens(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_ioenter(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -146,6 +150,10 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_uptimens] sys_uptimens,
+[SYS_ioenter] sys_ioenter,
+[SYS_fsync]   sys_fsync,
+[SYS_fdatasync] sys_fdatasync,
 };
 
 void
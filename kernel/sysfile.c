@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "syscall.h"
+#include "ioring.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -107,6 +109,34 @@ sys_close(void)
   return 0;
 }
 
+// Make every completed FS call durable, which covers f's
+// data and metadata: they are all in the one log.
+static int
+filesync(void)
+{
+  int fd;
+  struct file *f;
+
+  if(argfd(0, &fd, &f) < 0 || f->type == FD_PIPE)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+uint64
+sys_fsync(void)
+{
+  return filesync();
+}
+
+// Data and metadata go to disk together in the log, so there
+// is nothing less to do for fdatasync.
+uint64
+sys_fdatasync(void)
+{
+  return filesync();
+}
+
 uint64
 sys_fstat(void)
 {
@@ -129,7 +159,7 @@ sys_link(void)
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_op(LINKBLOCKS);
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -196,7 +226,7 @@ sys_unlink(void)
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_op(UNLINKBLOCKS);
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -314,7 +344,7 @@ sys_open(void)
   if((n = argstr(0, path, MAXPATH)) < 0)
     return -1;
 
-  begin_op();
+  begin_op((omode & O_CREATE) ? CREATEBLOCKS : IPUTBLOCKS);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -376,7 +406,7 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
-  begin_op();
+  begin_op(CREATEBLOCKS);
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -393,7 +423,7 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
-  begin_op();
+  begin_op(CREATEBLOCKS);
   argint(1, &major);
   argint(2, &minor);
   if((argstr(0, path, MAXPATH)) < 0 ||
@@ -413,7 +443,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
-  begin_op();
+  begin_op(IPUTBLOCKS);
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
@@ -503,3 +533,80 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// system calls that may be queued on an ioring.
+static uint64 (*ioring_ops[])(void) = {
+[SYS_read]    sys_read,
+[SYS_write]   sys_write,
+[SYS_open]    sys_open,
+[SYS_close]   sys_close,
+[SYS_fstat]   sys_fstat,
+};
+
+// int ioenter(struct ioring *r, int n)
+// execute up to n queued entries of the user's ioring in one
+// trap, instead of one trap per system call. each entry runs
+// through ioring_ops[] with its arguments in a0..a2, as if the
+// process had made the call itself.
+// returns the number of entries executed, or -1 if the ring
+// is not in user memory.
+uint64
+sys_ioenter(void)
+{
+  struct proc *p = myproc();
+  struct ioring *r;   // user address; never dereferenced
+  uint64 ra, saved[3];
+  int n, done, res;
+  uint idx[4];        // sqhead, sqtail, cqhead, cqtail
+  struct iosqe sqe;
+  struct iocqe cqe;
+
+  argaddr(0, &ra);
+  argint(1, &n);
+  r = (struct ioring *)ra;
+  if(copyin(p->pagetable, (char*)idx, (uint64)&r->sqhead, sizeof(idx)) < 0)
+    return -1;
+
+  saved[0] = p->trapframe->a0;
+  saved[1] = p->trapframe->a1;
+  saved[2] = p->trapframe->a2;
+
+  res = 0;
+  for(done = 0; done < n && idx[0] != idx[1] && idx[3] - idx[2] < IORING_NENT; done++){
+    if(copyin(p->pagetable, (char*)&sqe, (uint64)&r->sq[idx[0] % IORING_NENT], sizeof(sqe)) < 0)
+      break;
+    if(sqe.op <= 0 || sqe.op >= NELEM(ioring_ops) || ioring_ops[sqe.op] == 0){
+      res = -1;
+    } else if((sqe.flags & IOSQE_PREVLEN) && (done == 0 || res <= 0)){
+      // the entry it depends on failed, hit EOF, or
+      // ran in an earlier ioenter().
+      if(done == 0)
+        res = -1;
+    } else {
+      if(sqe.flags & IOSQE_PREVLEN)
+        sqe.args[2] = res;
+      p->trapframe->a0 = sqe.args[0];
+      p->trapframe->a1 = sqe.args[1];
+      p->trapframe->a2 = sqe.args[2];
+      res = ioring_ops[sqe.op]();
+    }
+    cqe.user_data = sqe.user_data;
+    cqe.res = res;
+    cqe.pad = 0;
+    if(copyout(p->pagetable, (uint64)&r->cq[idx[3] % IORING_NENT], (char*)&cqe, sizeof(cqe)) < 0)
+      break;
+    idx[0]++;
+    idx[3]++;
+    if(killed(p))
+      break;
+  }
+
+  p->trapframe->a0 = saved[0];
+  p->trapframe->a1 = saved[1];
+  p->trapframe->a2 = saved[2];
+
+  if(copyout(p->pagetable, (uint64)&r->sqhead, (char*)&idx[0], sizeof(uint)) < 0 ||
+     copyout(p->pagetable, (uint64)&r->cqtail, (char*)&idx[3], sizeof(uint)) < 0)
+    return -1;
+  return done;
+}
@@ -52,22 +52,11 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepuntil(r_time() + (uint64)n * TICKINTERVAL);
 }
 
 uint64
@@ -79,15 +68,17 @@ sys_kill(void)
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
-// since start.
+// return how many clock ticks have passed since start.
+// lock-free: derived from the time CSR.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  return getticks();
+}
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+// return nanoseconds since start.
+uint64
+sys_uptimens(void)
+{
+  return uptimens();
 }
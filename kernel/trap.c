@@ -28,11 +28,19 @@
 //               -> registr kernelvec -> kerneltrap  sret回到以前的模式还是内核模式 ->执行sepc
 
 
+// ticks are no longer counted by hart 0's timer interrupt; they
+// are derived from the time CSR on demand (see getticks()), so
+// an idle hart can leave its timer off until the next sleep()
+// deadline. tickslock only protects updates of nextwake and the
+// sleepers on it; readers of the clock never take a lock.
 struct spinlock tickslock;
-uint ticks;
+uint64 nextwake = -1;  // earliest r_time() deadline of any sleeper
 
 extern char trampoline[], uservec[], userret[];
 
+// in usercopy.S.
+extern char ucopy_start[], ucopy_end[], ucopy_fault[];
+
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
@@ -49,6 +57,10 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+
+  // let user space read the time CSR, for uptime()
+  // from the usyscall page without a system call.
+  w_scounteren(r_scounteren() | 2);
 }
 
 // handle an interrupt, exception, or system call from user space.
@@ -198,7 +210,7 @@ usertrapret(void)
   w_sepc(p->trapframe->epc); // 设置执行sret后 恢复到正常的用户态的执行指令
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = uvmsatp(p);
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -223,6 +235,16 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
+  // a page fault on a user address in ucopy() or ucopystr()
+  // means a bad user address: make the copy return -1 (an
+  // exception table with one entry). a fault on a kernel
+  // address is a kernel bug, and panics below.
+  if((scause == 13 || scause == 15) && r_stval() < UKVMTOP &&
+     sepc >= (uint64)ucopy_start && sepc < (uint64)ucopy_end){
+    w_sepc((uint64)ucopy_fault);
+    return;
+  }
+
   if((which_dev = devintr()) == 0){
     // interrupt or trap from an unknown source
     printf("scause=0x%lx sepc=0x%lx stval=0x%lx\n", scause, r_sepc(), r_stval());
@@ -231,10 +253,15 @@ kerneltrap()
 
   // give up the CPU if this is a timer interrupt.
   // // 场景 2) cpu在执行进程的内核态指令,被定时器中断打断,进入kerneltrap,调用yield 放弃执行进入scheduler
-  if(which_dev == 2 && myproc() != 0)
+  if(which_dev == 2 && myproc() != 0){
+    // a tick in ucopy() leaves SUM set; swtch() doesn't save
+    // sstatus, so clear it for whatever runs next on this hart.
+    // w_sstatus(sstatus) below sets it again on resume.
+    w_sstatus(r_sstatus() & ~SSTATUS_SUM);
     // 1)放弃CPU的执行,后最终会通关scheduler调度器yield的下一行c代码,最终完成 回到用户空间
     // 2) 调用yield 会导致中断被打开 导致 sepc和sstatus被修改.但是为什么 usertrap就不怕呢???
     yield();
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -243,21 +270,89 @@ kerneltrap()
 }
 
 
+// number of clock ticks since boot.
+// qemu starts the time CSR at zero, so no lock or
+// counter is needed, just a division.
+uint
+getticks(void)
+{
+  return r_time() / TICKINTERVAL;
+}
+
+// nanoseconds since boot, at the resolution of the time CSR.
+uint64
+uptimens(void)
+{
+  return r_time() * (1000000000L / TIMEBASE);
+}
+
+// sleep until the time CSR reaches deadline.
+// return -1 if killed, 0 otherwise.
+int
+sleepuntil(uint64 deadline)
+{
+  struct proc *p = myproc();
+
+  if(r_time() >= deadline)
+    return 0;
+
+  acquire(&tickslock);
+  while(r_time() < deadline){
+    if(killed(p)){
+      release(&tickslock);
+      return -1;
+    }
+    // re-arm after every wakeup, since clockintr()
+    // resets nextwake when it wakes the sleepers.
+    if(deadline < nextwake)
+      __atomic_store_n(&nextwake, deadline, __ATOMIC_RELEASE);
+    sleep(&nextwake, &tickslock);
+  }
+  release(&tickslock);
+  return 0;
+}
+
+// program this hart's timer for an idle period: no periodic
+// tick, only the next sleep() deadline. called by scheduler()
+// just before wfi.
+void
+clockidle(void)
+{
+  w_stimecmp(__atomic_load_n(&nextwake, __ATOMIC_ACQUIRE));
+}
+
+// program this hart's periodic tick again, if clockidle()
+// turned it off. called by scheduler() before running a process,
+// so that it can be preempted.
+void
+clockbusy(void)
+{
+  uint64 now = r_time();
+
+  if(r_stimecmp() > now + TICKINTERVAL)
+    w_stimecmp(now + TICKINTERVAL);
+}
+
 // 每个cpu有独立时钟源
+// any hart may find the earliest deadline has passed; only then
+// is tickslock taken, so busy harts don't contend on every tick.
 void
 clockintr()
 {
-  if(cpuid() == 0){
+  uint64 now = r_time();
+
+  // a stale nextwake only delays the wakeup by one tick.
+  if(now >= __atomic_load_n(&nextwake, __ATOMIC_ACQUIRE)){
     acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
+    __atomic_store_n(&nextwake, -1, __ATOMIC_RELEASE);
+    wakeup(&nextwake);
     release(&tickslock);
   }
 
   // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
+  // the interrupt request. TICKINTERVAL is about a tenth
   // of a second.
-  w_stimecmp(r_time() + 1000000);
+  w_stimecmp(now + TICKINTERVAL);
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -29,6 +29,10 @@
 #define VIRTIO_MMIO_DRIVER_DESC_HIGH	0x094
 #define VIRTIO_MMIO_DEVICE_DESC_LOW	0x0a0 // physical address for used ring, write-only
 #define VIRTIO_MMIO_DEVICE_DESC_HIGH	0x0a4
+#define VIRTIO_MMIO_CONFIG		0x100 // device-specific configuration space
+
+// offset of num_queues in the block device configuration.
+#define VIRTIO_BLK_CONFIG_NUM_QUEUES	34
 
 // status register bits, from qemu virtio_config.h
 #define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
@@ -45,9 +49,10 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
+// at most this many virtio descriptors; the queue gets the
+// device's maximum size, if that is smaller.
 // must be a power of two.
-#define NUM 8
+#define NUM 1024
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -59,12 +64,13 @@ struct virtq_desc {
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
 
-// the (entire) avail ring, from the spec.
+// the avail ring, from the spec. it has as many entries as
+// the queue, followed by used_event: with VIRTIO_RING_F_EVENT_IDX,
+// the device interrupts only when used->idx passes it.
 struct virtq_avail {
   uint16 flags; // always zero
   uint16 idx;   // driver will write ring[idx] next
-  uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 ring[]; // descriptor numbers of chain heads
 };
 
 // one entry in the "used" ring, with which the
@@ -74,12 +80,21 @@ struct virtq_used_elem {
   uint32 len;
 };
 
+// the used ring, followed by avail_event: with
+// VIRTIO_RING_F_EVENT_IDX, the driver notifies the device
+// only when avail->idx passes it.
 struct virtq_used {
   uint16 flags; // always zero
   uint16 idx;   // device increments when it adds a ring[] entry
-  struct virtq_used_elem ring[NUM];
+  struct virtq_used_elem ring[];
 };
 
+// with VIRTIO_RING_F_EVENT_IDX, should moving idx from old to
+// new signal the other side, which asked to hear when idx
+// passes event?
+#define VRING_NEED_EVENT(event, new, old) \
+  ((uint16)((new) - (event) - 1) < (uint16)((new) - (old)))
+
 // these are specific to virtio block devices, e.g. disks,
 // described in Section 5.2 of the spec.
 
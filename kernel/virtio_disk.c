@@ -2,7 +2,7 @@
 // driver for qemu's virtio disk device.
 // uses qemu's mmio interface to virtio.
 //
-// qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
+// qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0,num-queues=N
 //
 
 #include "types.h"
@@ -19,10 +19,23 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
-static struct disk {
+// how long a polled request spins for its completion before
+// sleeping until the interrupt, in timer cycles (50 us).
+#define POLLCYCLES (TIMEBASE / 20000)
+
+// what we track about an in-flight operation.
+struct vinfo {
+  struct buf *b;   // first buf, linked through qnext
+  int n;           // number of bufs
+  char status;
+};
+
+// one virtqueue. with VIRTIO_BLK_F_MQ each hart submits to
+// its own, under its own lock.
+struct virtq {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
-  // disk operations. there are NUM descriptors.
+  // disk operations. there are num descriptors.
   // most commands consist of a "chain" (a linked list) of a couple of
   // these descriptors.
   struct virtq_desc *desc;
@@ -30,40 +43,123 @@ static struct disk {
   // a ring in which the driver writes descriptor numbers
   // that the driver would like the device to process.  it only
   // includes the head descriptor of each chain. the ring has
-  // NUM elements.
+  // num elements.
   struct virtq_avail *avail;
 
   // a ring in which the device writes descriptor numbers that
   // the device has finished processing (just the head of each chain).
-  // there are NUM used ring entries.
+  // there are num used ring entries.
   struct virtq_used *used;
 
-  // our own book-keeping.
-  char free[NUM];  // is a descriptor free?
-  uint16 used_idx; // we've looked this far in used[2..NUM].
+  // with VIRTIO_RING_F_EVENT_IDX, where the driver and device
+  // say when they want to hear about the other's ring updates.
+  volatile uint16 *used_event; // after avail->ring[num]
+  volatile uint16 *avail_event; // after used->ring[num]
+
+  // our own book-keeping, each array num long, allocated
+  // once the device has said how big the queue can be.
+  int qid;         // queue number, for QUEUE_SEL and QUEUE_NOTIFY
+  int num;         // queue size, a power of two <= NUM
+  char *free;      // is a descriptor free?
+  uint16 used_idx; // we've looked this far in used[2..num].
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
-  struct {
-    struct buf *b;
-    char status;
-  } info[NUM];
+  struct vinfo *info;
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
-  struct virtio_blk_req ops[NUM];
-  
-  struct spinlock vdisk_lock;
+  struct virtio_blk_req *ops;
   
+  struct spinlock lock;
+};
+
+static struct disk {
+  struct virtq *q; // nq of them
+  int nq;          // queues in use
+  int event_idx;   // negotiated VIRTIO_RING_F_EVENT_IDX?
+  int poll;        // poll for every request's completion?
 } disk;
 
+// allocate zeroed, physically contiguous memory of sz bytes,
+// for a ring or the driver's book-keeping.
+static void *
+alloc_ring(uint64 sz)
+{
+  int order = 0;
+  void *p;
+
+  while((PGSIZE << order) < sz)
+    order++;
+  if((p = kalloc_pages(order)) == 0)
+    panic("virtio disk kalloc");
+  memset(p, 0, PGSIZE << order);
+  return p;
+}
+
+// set up virtqueue qid, using the largest power-of-two size
+// the device allows, up to NUM.
+static void
+init_queue(struct virtq *q, int qid)
+{
+  initlock(&q->lock, "virtio_disk");
+  q->qid = qid;
+
+  *R(VIRTIO_MMIO_QUEUE_SEL) = qid;
+
+  // ensure the queue is not in use.
+  if(*R(VIRTIO_MMIO_QUEUE_READY))
+    panic("virtio disk should not be ready");
+
+  // check maximum queue size.
+  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  if(max == 0)
+    panic("virtio disk has no queue");
+  for(q->num = NUM; q->num > max; q->num /= 2)
+    ;
+  // a request needs a header, a data and a status descriptor.
+  if(q->num < 3)
+    panic("virtio disk max queue too short");
+
+  // allocate and zero queue memory.
+  q->desc = alloc_ring(q->num * sizeof(struct virtq_desc));
+  q->avail = alloc_ring(sizeof(struct virtq_avail) + (q->num + 1) * sizeof(uint16));
+  q->used = alloc_ring(sizeof(struct virtq_used) +
+                       q->num * sizeof(struct virtq_used_elem) + sizeof(uint16));
+  q->used_event = &q->avail->ring[q->num];
+  q->avail_event = (uint16*)&q->used->ring[q->num];
+  q->free = alloc_ring(q->num);
+  q->info = alloc_ring(q->num * sizeof(struct vinfo));
+  q->ops = alloc_ring(q->num * sizeof(struct virtio_blk_req));
+
+  // set queue size.
+  *R(VIRTIO_MMIO_QUEUE_NUM) = q->num;
+
+  // write physical addresses.
+  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)q->desc;
+  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)q->desc >> 32;
+  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)q->avail;
+  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)q->avail >> 32;
+  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)q->used;
+  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)q->used >> 32;
+
+  // queue is ready.
+  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
+
+  // all num descriptors start out unused.
+  for(int i = 0; i < q->num; i++)
+    q->free[i] = 1;
+}
+
 void
 virtio_disk_init(void)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
+#ifdef DISKPOLL
+  disk.poll = 1;
+#endif
 
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 2 ||
@@ -88,11 +184,10 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.event_idx = (features >> VIRTIO_RING_F_EVENT_IDX) & 1;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -103,47 +198,17 @@ virtio_disk_init(void)
   if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
     panic("virtio disk FEATURES_OK unset");
 
-  // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-
-  // ensure queue 0 is not in use.
-  if(*R(VIRTIO_MMIO_QUEUE_READY))
-    panic("virtio disk should not be ready");
-
-  // check maximum queue size.
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-    panic("virtio disk has no queue 0");
-  if(max < NUM)
-    panic("virtio disk max queue too short");
-
-  // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
-    panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
-
-  // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-
-  // write physical addresses.
-  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
-  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk.desc >> 32;
-  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk.avail;
-  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk.avail >> 32;
-  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk.used;
-  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk.used >> 32;
-
-  // queue is ready.
-  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
-
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+  // one queue per hart, if the device has that many.
+  disk.nq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ))
+    disk.nq = *(volatile uint16 *)R(VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CONFIG_NUM_QUEUES);
+  if(disk.nq < 1)
+    disk.nq = 1;
+  if(disk.nq > NCPU)
+    disk.nq = NCPU;
+  disk.q = alloc_ring(disk.nq * sizeof(struct virtq));
+  for(int i = 0; i < disk.nq; i++)
+    init_queue(&disk.q[i], i);
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
@@ -154,11 +219,11 @@ virtio_disk_init(void)
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct virtq *q)
 {
-  for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+  for(int i = 0; i < q->num; i++){
+    if(q->free[i]){
+      q->free[i] = 0;
       return i;
     }
   }
@@ -167,28 +232,28 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct virtq *q, int i)
 {
-  if(i >= NUM)
+  if(i >= q->num)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(q->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  q->desc[i].addr = 0;
+  q->desc[i].len = 0;
+  q->desc[i].flags = 0;
+  q->desc[i].next = 0;
+  q->free[i] = 1;
+  wakeup(&q->free[0]);
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct virtq *q, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = q->desc[i].flags;
+    int nxt = q->desc[i].next;
+    free_desc(q, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -196,46 +261,100 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// a disk transfer of k blocks uses k+2 descriptors.
 static int
-alloc3_desc(int *idx)
+allocn_desc(struct virtq *q, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(q);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(q, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// with EVENT_IDX, ask the device to interrupt once a quarter
+// of the requests in flight have completed, rather than after
+// each one. caller holds q->lock.
+static void
+set_used_event(struct virtq *q)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint16 inflight = q->avail->idx - q->used_idx;
+  uint16 batch = inflight / 4;
 
-  acquire(&disk.vdisk_lock);
+  if(batch == 0)
+    batch = 1;
+  *q->used_event = q->used_idx + batch - 1;
+}
+
+// take finished requests off q's used ring and wake up
+// their waiters. caller holds q->lock.
+static void
+complete(struct virtq *q)
+{
+  // the device increments q->used->idx when it
+  // adds an entry to the used ring.
+
+  do {
+    while(q->used_idx != q->used->idx){
+      __sync_synchronize();
+      int id = q->used->ring[q->used_idx % q->num].id;
+
+      if(q->info[id].status != 0)
+        panic("virtio_disk_intr status");
+
+      // the disk is done with the request's bufs.
+      struct buf *b = q->info[id].b;
+      for(int i = q->info[id].n; i > 0; i--){
+        struct buf *nb = b->qnext;
+        blk_done(b);
+        b = nb;
+      }
+      q->info[id].b = 0;
+      free_chain(q, id);
+
+      q->used_idx += 1;
+    }
+    if(!disk.event_idx)
+      break;
+    // completions that arrive before the device sees the
+    // new used_event won't interrupt; look for them again.
+    set_used_event(q);
+    __sync_synchronize();
+  } while(q->used_idx != q->used->idx);
+}
+
+// start a transfer of the n bufs linked through b->qnext,
+// which hold consecutive blocks, to (write=1) or from the disk.
+// blk_done() is called for each when the disk is finished.
+static void
+submit(struct virtq *q, struct buf *b, int n, int write)
+{
+  uint64 sector = b->blockno * (BSIZE / 512);
+  int idx[MAXMERGE+2];
+  struct buf *bp;
+  int i;
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, then descriptors for
+  // the data, then one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(allocn_desc(q, idx, n+2) == 0) {
       break;
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    sleep(&q->free[0], &q->lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &q->ops[idx[0]];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -244,58 +363,107 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
+  q->desc[idx[0]].addr = (uint64) buf0;
+  q->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  q->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  q->desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(i = 1, bp = b; i <= n; i++, bp = bp->qnext){
+    q->desc[idx[i]].addr = (uint64) bp->data;
+    q->desc[idx[i]].len = BSIZE;
+    if(write)
+      q->desc[idx[i]].flags = 0; // device reads bp->data
+    else
+      q->desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes bp->data
+    q->desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    q->desc[idx[i]].next = idx[i+1];
+  }
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  q->info[idx[0]].status = 0xff; // device writes 0 on success
+  q->desc[idx[n+1]].addr = (uint64) &q->info[idx[0]].status;
+  q->desc[idx[n+1]].len = 1;
+  q->desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  q->desc[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the bufs for complete().
+  q->info[idx[0]].b = b;
+  q->info[idx[0]].n = n;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  uint16 old = q->avail->idx;
+  q->avail->ring[old % q->num] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  q->avail->idx = old + 1; // not % num ...
+  set_used_event(q);
 
   __sync_synchronize();
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  // with EVENT_IDX, a device that is still working through
+  // the ring says it needn't be told about this entry.
+  if(!disk.event_idx || VRING_NEED_EVENT(*q->avail_event, old + 1, old))
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = q->qid; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// start transferring the n bufs linked through b->qnext, which
+// hold consecutive blocks, as few requests as the queue allows.
+// called by blkq.c.
+void
+virtio_disk_submit(struct buf *b, int n, int write)
+{
+  struct virtq *q;
+  struct buf *next;
+  int k;
+
+  if(n > MAXMERGE)
+    panic("virtio_disk_submit");
+
+  // use this hart's queue. if the process moves to another
+  // hart meanwhile, it still finishes on this queue.
+  push_off();
+  q = &disk.q[cpuid() % disk.nq];
+  pop_off();
+
+  acquire(&q->lock);
+  while(n > 0){
+    k = n < q->num - 2 ? n : q->num - 2;
+    next = b;
+    for(int i = 0; i < k; i++)
+      next = next->qnext;
+    submit(q, b, k, write);
+    b = next;
+    n -= k;
   }
+  release(&q->lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
-  release(&disk.vdisk_lock);
+// a polled request spins on the used rings for a while, which
+// is quicker than an interrupt and a trip through the
+// scheduler when the device finishes promptly.
+// called by blk_wait() before it sleeps.
+void
+virtio_disk_poll(struct buf *b)
+{
+  if(!b->poll && !disk.poll)
+    return;
+  uint64 deadline = r_time() + POLLCYCLES;
+  while(b->disk == 1 && r_time() < deadline){
+    for(int i = 0; i < disk.nq; i++){
+      struct virtq *q = &disk.q[i];
+      if(q->used_idx == *(volatile uint16*)&q->used->idx)
+        continue;
+      acquire(&q->lock);
+      complete(q);
+      release(&q->lock);
+    }
+  }
 }
 
 void
 virtio_disk_intr()
 {
-  acquire(&disk.vdisk_lock);
-
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
   // this may race with the device writing new entries to
@@ -306,22 +474,15 @@ virtio_disk_intr()
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
-
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
-
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
-
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
-
-    disk.used_idx += 1;
+  // virtio-mmio has one interrupt for all queues, so look at
+  // each of them; a queue another hart is already draining
+  // (or polling) is left to it.
+  for(int i = 0; i < disk.nq; i++){
+    struct virtq *q = &disk.q[i];
+    if(q->used_idx == *(volatile uint16*)&q->used->idx)
+      continue;
+    acquire(&q->lock);
+    complete(q);
+    release(&q->lock);
   }
-
-  release(&disk.vdisk_lock);
 }
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -23,6 +25,15 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static pte_t *walklevel(pagetable_t, uint64, int, int);
+
+// kalloc_pages() order of a 2 MB superpage.
+#define MEGAORDER (PXSHIFT(1) - PGSHIFT)
+
+// usercopy.S
+extern int ucopy(void *dst, void *src, uint64 n);
+extern int ucopystr(char *dst, char *src, uint64 max);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -93,26 +104,58 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+// A walk that meets a leaf PTE at level 2 or 1 (a 1 GB or
+// 2 MB superpage) stops there and returns that PTE.
 // 这个函数根据虚拟地址找到对应的pte
 // 模仿 RISC-V 分页硬件查找虚拟地址的 PTE   MMU查找功能的软实现
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, 0, alloc);
+}
+
+// like walk(), but return the PTE at level instead of
+// descending to level 0.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int level, int alloc)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(level, va)];
+}
+
+// return the valid leaf PTE that maps user address va, or 0,
+// and set *pa to the physical address of the page holding va,
+// which is inside the superpage if the leaf is at level 1.
+static pte_t *
+walkpage(pagetable_t pagetable, uint64 va, uint64 *pa)
+{
+  pte_t *pte;
+
+  if((pte = walklevel(pagetable, va, 1, 0)) == 0 || (*pte & PTE_V) == 0)
+    return 0;
+  if(PTE_LEAF(*pte)){
+    *pa = PTE2PA(*pte) + (PGROUNDDOWN(va) & (PXSIZE(1) - 1));
+    return pte;
+  }
+  pte = &((pagetable_t)PTE2PA(*pte))[PX(0, va)];
+  if((*pte & PTE_V) == 0)
+    return 0;
+  *pa = PTE2PA(*pte);
+  return pte;
 }
 
 // Look up a virtual address, return the physical address,
@@ -128,14 +171,11 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkpage(pagetable, va, &pa);
   if(pte == 0)
     return 0;
-  if((*pte & PTE_V) == 0)
-    return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
   return pa;
 }
 
@@ -151,7 +191,9 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
-// va and size MUST be page-aligned.
+// va and size MUST be page-aligned. Where va and pa are both
+// 2 MB or 1 GB aligned and enough of size remains, a single
+// level-1 or level-2 leaf PTE maps the whole superpage.
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 // 该函数实际就是完成虚拟地址到物理地址的页表映射（注意是页表）。就是设置PTE的值。也就是给每个PTE 写入PPN 和flags
@@ -162,6 +204,7 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
   uint64 a, last;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("mappages: va not aligned");
@@ -173,34 +216,109 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     panic("mappages: size");
   
   a = va;
-  last = va + size - PGSIZE;
-  for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
-      return -1;
+  last = va + size;
+  while(a < last){
+    // the largest page size a and pa are aligned to that fits.
+    for(level = 2; level > 0; level--)
+      if(((a | pa) & (PXSIZE(level) - 1)) == 0 && last - a >= PXSIZE(level))
+        break;
+    for(;;){
+      if((pte = walklevel(pagetable, a, level, 1)) == 0)
+        return -1;
+      if(level == 0 || (*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+        break;
+      level--;  // there's already a page-table page here; map inside it.
+    }
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;  // 主要的赋值。 设置PPN 和flags
-    if(a == last)
-      break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += PXSIZE(level);
+    pa += PXSIZE(level);
   }
   return 0;
 }
 
+// replace the 2 MB superpage leaf *pte with the level-0 page
+// table l0, filled in to map the same memory 4 KB at a time.
+static void
+demote(pte_t *pte, pagetable_t l0)
+{
+  uint64 pa = PTE2PA(*pte);
+  uint64 flags = PTE_FLAGS(*pte);
+
+  for(int i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(l0) | PTE_V;
+}
+
+// does [va, end) cover only part of a superpage mapped at a?
+static int
+partsuper(pagetable_t pagetable, uint64 a, uint64 va, uint64 end)
+{
+  pte_t *pte = walklevel(pagetable, a, 1, 0);
+  uint64 base = a & ~(PXSIZE(1) - 1);
+
+  if(pte == 0 || (*pte & PTE_V) == 0 || !PTE_LEAF(*pte))
+    return 0;
+  return base < va || base + PXSIZE(1) > end;
+}
+
 // Remove npages of mappings starting from va. va must be
 // page-aligned. The mappings must exist.
 // Optionally free the physical memory.
-void
+// A superpage the range covers is removed whole; one it
+// only partly covers is split into 4 KB pages first.
+// Returns -1, having changed nothing, if there is no memory
+// for the split; that can only happen if do_free is 0.
+int
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end = va + npages*PGSIZE;
   pte_t *pte;
+  pagetable_t l0, spare[2];
+  int nspare = 0;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+  // only the superpages at the two ends can be partly
+  // covered; get their level-0 pages before changing anything.
+  if(!do_free && npages > 0){
+    int n = partsuper(pagetable, va, va, end);
+    if((va ^ (end - PGSIZE)) & ~(PXSIZE(1) - 1))  // ends in different superpages
+      n += partsuper(pagetable, end - PGSIZE, va, end);
+    for(; nspare < n; nspare++){
+      if((spare[nspare] = (pagetable_t)kalloc()) == 0){
+        while(nspare > 0)
+          kfree(spare[--nspare]);
+        return -1;
+      }
+    }
+  }
+
+  for(a = va; a < end; a += PGSIZE){
+    pte = walklevel(pagetable, a, 1, 0);
+    if(pte && (*pte & PTE_V) && PTE_LEAF(*pte)){
+      if((a % PXSIZE(1)) == 0 && end - a >= PXSIZE(1)){
+        if(do_free)
+          kfree_pages((void*)PTE2PA(*pte), MEGAORDER);
+        *pte = 0;
+        a += PXSIZE(1) - PGSIZE;
+        continue;
+      }
+      if(do_free){
+        // a's page is being freed anyway; it becomes the
+        // new level-0 page table, so splitting can't fail.
+        l0 = (pagetable_t)(PTE2PA(*pte) + (a & (PXSIZE(1) - 1)));
+        demote(pte, l0);
+        l0[PX(0, a)] = 0;
+        continue;
+      }
+      if(nspare == 0)
+        panic("uvmunmap: split");
+      l0 = spare[--nspare];
+      demote(pte, l0);
+    }
     if((pte = walk(pagetable, a, 0)) == 0)
       panic("uvmunmap: walk");
     if((*pte & PTE_V) == 0)
@@ -213,6 +331,7 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     }
     *pte = 0;
   }
+  return 0;
 }
 
 // create an empty user page table.
@@ -221,10 +340,7 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc(); // 一级页表
-  if(pagetable == 0)
-    return 0;
-  memset(pagetable, 0, PGSIZE);
+  pagetable = (pagetable_t) kalloc_zeroed(); // 一级页表
   return pagetable;
 }
 
@@ -250,26 +366,36 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 // 有一点不明白：启动MMU映射后为什么还需要调用kalloc去触发物理内存分配？？ 应该初始化的时候将所有虚拟内存都映射为物理内存。然后就不需要调用kalloc和kfree了
 // 答案： kvminit初始化了128MB页表项。 但是没有实际分配物理页来存储数据。这里就是实际分配物理页用来存储数据
 // 这里不支持 lazy alloc（读写的时候才分配真实物理页） 而是立即分配物理页
+// Aligned 2 MB stretches of the new memory are backed by a
+// superpage when the buddy allocator has one free.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
   char *mem;
-  uint64 a;
+  uint64 a, n;
+  int order;
 
   if(newsz < oldsz)
     return oldsz;
 
   oldsz = PGROUNDUP(oldsz);
-  for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+  for(a = oldsz; a < newsz; a += n){
+    n = PGSIZE;
+    order = 0;
+    if((a % PXSIZE(1)) == 0 && newsz - a >= PXSIZE(1) &&
+       (mem = kalloc_pages_zeroed(MEGAORDER)) != 0){
+      n = PXSIZE(1);
+      order = MEGAORDER;
+    } else {
+      mem = kalloc_zeroed();
+    }
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     // map之后 就可以用虚拟地址来访问了。 不需要用物理地址了
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
-      kfree(mem);
+    if(mappages(pagetable, a, n, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
+      kfree_pages(mem, order);
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
@@ -336,22 +462,30 @@ int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
   pte_t *pte;
-  uint64 pa, i;
+  uint64 pa, i, n;
   uint flags;
   char *mem;
+  int order;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
+  for(i = 0; i < sz; i += n){
+    if((pte = walkpage(old, i, &pa)) == 0)
       panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    // copy a superpage into a superpage if memory allows,
+    // else a page at a time.
+    n = PGSIZE;
+    order = 0;
+    mem = 0;
+    if(pte == walklevel(old, i, 1, 0) && (i % PXSIZE(1)) == 0 &&
+       (mem = kalloc_pages(MEGAORDER)) != 0){
+      n = PXSIZE(1);
+      order = MEGAORDER;
+    }
+    if(mem == 0 && (mem = kalloc()) == 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    memmove(mem, (char*)pa, n);
+    if(mappages(new, i, n, (uint64)mem, flags) != 0){
+      kfree_pages(mem, order);
       goto err;
     }
   }
@@ -362,17 +496,246 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Make a kernel page table for a process: a copy of the kernel's
+// root page and of its first level-1 page, whose entries below
+// UKVMTOP ukvmsync() points at the process's own level-0 pages.
+// the kernel runs on it while the process is current.
+// returns 0 if out of memory.
+pagetable_t
+ukvmcreate(void)
+{
+  pagetable_t kpt, l1;
+
+  if((kpt = (pagetable_t)kalloc()) == 0)
+    return 0;
+  if((l1 = (pagetable_t)kalloc()) == 0){
+    kfree(kpt);
+    return 0;
+  }
+  memmove(kpt, kernel_pagetable, PGSIZE);
+  if(kernel_pagetable[0] & PTE_V)
+    memmove(l1, (void*)PTE2PA(kernel_pagetable[0]), PGSIZE);
+  else
+    memset(l1, 0, PGSIZE);
+  kpt[0] = PA2PTE(l1) | PTE_V;
+  return kpt;
+}
+
+// free a page table made by ukvmcreate(). the rest of
+// it is shared with the kernel or the user page table.
+void
+ukvmfree(pagetable_t kpt)
+{
+  kfree((void*)PTE2PA(kpt[0]));
+  kfree((void*)kpt);
+}
+
+// make kpt map the same user memory below UKVMTOP as pagetable.
+// only the level-1 entries are copied; the level-0 pages are
+// shared, so this is needed only when pagetable is replaced or
+// may have gained or lost level-0 pages or superpages.
+// the caller flushes the TLB with uvmflush() if the process
+// may have run.
+void
+ukvmsync(pagetable_t kpt, pagetable_t pagetable)
+{
+  pagetable_t kl1 = (pagetable_t)PTE2PA(kpt[0]);
+  pagetable_t ul1 = 0;
+
+  if(pagetable[0] & PTE_V)
+    ul1 = (pagetable_t)PTE2PA(pagetable[0]);
+  for(int i = 0; i < PX(1, UKVMTOP); i++)
+    kl1[i] = ul1 ? ul1[i] : 0;
+}
+
+// ASIDs tag TLB entries with the page table they came from, so
+// that switching satp between a process's user page table, its
+// kernel page table, and other processes' needn't flush the TLB.
+// a process's user page table gets an even ASID and its kernel
+// page table the odd one above it; kernel_pagetable has ASID 0.
+// ASIDs are handed out in order and never reused within a
+// generation, so a dead process's stale entries are harmless.
+// when they run out a new generation starts, and each hart
+// flushes its whole TLB before it uses an ASID of the new one.
+#define ASIDMASK  0xFFFFL
+#define ASIDGEN   (ASIDMASK + 1)
+
+struct {
+  struct spinlock lock;
+  uint64 gen;     // current generation, a multiple of ASIDGEN
+  uint64 next;    // next free user ASID in this generation
+  uint64 nasid;   // ASIDs the hardware implements; 0 if too few to use
+} asids;
+
+// find out how many ASID bits satp implements.
+// called on hart 0 once paging is on.
+void
+asidinit(void)
+{
+  uint64 n;
+
+  initlock(&asids.lock, "asids");
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID(ASIDMASK));
+  n = SATP2ASID(r_satp()) + 1;
+  w_satp(MAKE_SATP(kernel_pagetable));
+  sfence_vma();
+  asids.nasid = n >= 4 ? n : 0;
+  asids.gen = ASIDGEN;
+  asids.next = 2;
+}
+
+// give p a fresh pair of ASIDs, which no hart's TLB has
+// entries for. caller holds asids.lock.
+static void
+asidnew(struct proc *p)
+{
+  if(asids.next + 1 >= asids.nasid){
+    asids.gen += ASIDGEN;
+    asids.next = 2;
+  }
+  p->asid = asids.gen | asids.next;
+  asids.next += 2;
+  p->tlbharts = 0;
+}
+
+// flush this hart's TLB if it last flushed for a generation
+// other than that of p's ASIDs, before it runs p. checking
+// p's generation rather than asids.gen keeps c->asidgen from
+// running ahead of the ASIDs this hart's TLB may hold when
+// another hart starts a new generation meanwhile.
+// interrupts must be off.
+static void
+asidcheck(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 gen = p->asid & ~ASIDMASK;
+
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+  }
+}
+
+// switch this hart to p's kernel page table, before the
+// scheduler runs p. caller holds p->lock.
+void
+ukvmswitch(struct proc *p)
+{
+  if(p->kpagetable == 0)
+    return;  // a kernel thread; stay on kernel_pagetable
+  if(asids.nasid == 0){
+    w_satp(MAKE_SATP(p->kpagetable));
+    sfence_vma();
+    return;
+  }
+  if((p->asid & ~ASIDMASK) != __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE)){
+    acquire(&asids.lock);
+    asidnew(p);
+    asidcheck(p);
+    release(&asids.lock);
+  } else {
+    asidcheck(p);
+  }
+  p->tlbharts |= 1L << cpuid();
+  w_satp(MAKE_SATP(p->kpagetable) | SATP_ASID(p->asid + 1));
+}
+
+// switch this hart back to kernel_pagetable, after p has run.
+void
+kvmswitch(void)
+{
+  w_satp(MAKE_SATP(kernel_pagetable));
+  if(asids.nasid == 0)
+    sfence_vma();
+}
+
+// the satp with which p runs in user space.
+uint64
+uvmsatp(struct proc *p)
+{
+  return MAKE_SATP(p->pagetable) | SATP_ASID(asids.nasid ? p->asid : 0);
+}
+
+// flush stale TLB entries after the current process p's page
+// tables change. if only this hart can have entries for p's
+// ASIDs, flush just those; otherwise move p to fresh ASIDs
+// rather than flush the other harts.
+void
+uvmflush(struct proc *p)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(asids.nasid == 0){
+    sfence_vma();
+  } else if((p->tlbharts & ~(1L << id)) == 0){
+    sfence_vma_asid(p->asid & ASIDMASK);
+    sfence_vma_asid((p->asid + 1) & ASIDMASK);
+  } else {
+    acquire(&asids.lock);
+    asidnew(p);
+    asidcheck(p);
+    release(&asids.lock);
+    p->tlbharts = 1L << id;
+    w_satp(MAKE_SATP(p->kpagetable) | SATP_ASID(p->asid + 1));
+  }
+  pop_off();
+}
+
+// can [va, va+len) of pagetable be reached directly,
+// through the current process's kernel page table?
+// returns the number of bytes from va that can: len, less
+// than len if the range runs into memory the process doesn't
+// own, or 0 if none can.
+static uint64
+ucopyok(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  uint64 top;
+
+  if(p == 0 || pagetable != p->pagetable || p->kpagetable == 0)
+    return 0;
+  top = PGROUNDUP(p->sz);
+  if(top > UKVMTOP)
+    top = UKVMTOP;
+  // the stack guard page isn't PTE_U, which SUM can't
+  // tell from a user page, so stop short of it.
+  if(p->guard && va < p->guard + PGSIZE){
+    if(va >= p->guard)
+      return 0;
+    if(top > p->guard)
+      top = p->guard;
+  }
+  if(va >= top || len > UKVMTOP - va)
+    return 0;
+  if(len > top - va)
+    len = top - va;
+  return len;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
-void
+// returns -1 if out of memory to split a superpage.
+int
 uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   
-  pte = walk(pagetable, va, 0);
+  uint64 pa;
+
+  pte = walkpage(pagetable, va, &pa);
   if(pte == 0)
     panic("uvmclear");
+  if(pte == walklevel(pagetable, va, 1, 0)){
+    pagetable_t l0 = (pagetable_t)kalloc();
+    if(l0 == 0)
+      return -1;
+    demote(pte, l0);
+    pte = walk(pagetable, va, 0);
+  }
   *pte &= ~PTE_U;
+  return 0;
 }
 
 // Copy from kernel to user.
@@ -385,15 +748,16 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
   uint64 n, va0, pa0;
   pte_t *pte;
 
+  if(len > 0 && ucopyok(pagetable, dstva, len) == len)
+    return ucopy((void*)dstva, src, len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva); // 目的地址是页面虚拟地址
     if(va0 >= MAXVA)
       return -1;
-    pte = walk(pagetable, va0, 0); // 获取页面的PPN
-    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
-       (*pte & PTE_W) == 0)
+    pte = walkpage(pagetable, va0, &pa0); // 找到页面的物理地址
+    if(pte == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_W) == 0)
       return -1;
-    pa0 = PTE2PA(*pte); // 找到页面的物理地址
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -415,6 +779,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(len > 0 && ucopyok(pagetable, srcva, len) == len)
+    return ucopy(dst, (void*)srcva, len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
@@ -445,6 +812,11 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  // a string that runs past the memory ucopyok() allows
+  // would fault on the slow path too, so -1 is right.
+  if(max > 0 && (n = ucopyok(pagetable, srcva, max)) > 0)
+    return ucopystr(dst, (char*)srcva, n);
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
@@ -36,6 +36,7 @@
 int nbitmap = FSSIZE/BPB + 1;
 int ninodeblocks = NINODES / IPB + 1;
 int nlog = LOGSIZE;
+uint fsflags;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -90,11 +91,34 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  // -l n: n log blocks, including the header block. at most
+  // LOGSIZE+1, a hard ceiling: the kernel's log header must
+  // fit in one disk sector so that writing it is atomic.
+  // -r: mount with relaxed durability (FS_RELAXED).
+  while(argc >= 2 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-l") == 0 && argc >= 3){
+      nlog = atoi(argv[2]);
+      if(nlog < MAXOPBLOCKS + nbitmap + 1 || nlog > LOGSIZE + 1){
+        fprintf(stderr, "mkfs: log size must be %d..%d (the header must fit one sector)\n",
+                MAXOPBLOCKS + nbitmap + 1, LOGSIZE + 1);
+        exit(1);
+      }
+      argc--;
+      argv++;
+    } else if(strcmp(argv[1], "-r") == 0){
+      fsflags |= FS_RELAXED;
+    } else
+      break;
+    argc--;
+    argv++;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l nlog] [-r] fs.img files...\n");
     exit(1);
   }
 
+  assert((BSIZE % 512) == 0 && BSIZE <= 4096);  // whole sectors, at most a page
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
@@ -114,6 +138,9 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.flags = xint(fsflags);
+  sb.version = xint(FSVERSION);
+  sb.bsize = xint(BSIZE);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -0,0 +1,102 @@
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+//
+// stream over a buffer mapped with 4 KB pages and over one
+// the kernel backs with 2 MB superpages, to show the cost of
+// TLB misses. prints ns per access for a sequential sum and
+// for a walk that touches one word per page.
+//
+
+#define SZ      (8*1024*1024)
+#define MEGA    (2*1024*1024)
+#define NPASS   16
+
+// grow the heap by SZ one page at a time, so that uvmalloc
+// never sees an aligned 2 MB stretch.
+char*
+smallpages(void)
+{
+  char *p = sbrk(0);
+
+  for(int i = 0; i < SZ; i += PGSIZE)
+    if(sbrk(PGSIZE) == (char*)-1)
+      return 0;
+  return p;
+}
+
+// grow the heap in one step and return its first 2 MB
+// aligned address, which uvmalloc maps with superpages.
+char*
+bigpages(void)
+{
+  uint64 p = (uint64)sbrk(SZ + MEGA);
+
+  if(p == (uint64)-1)
+    return 0;
+  return (char*)((p + MEGA - 1) & ~(uint64)(MEGA - 1));
+}
+
+uint64
+seqsum(uint64 *buf)
+{
+  uint64 sum = 0;
+
+  for(int pass = 0; pass < NPASS; pass++)
+    for(int i = 0; i < SZ / sizeof(uint64); i++)
+      sum += buf[i];
+  return sum;
+}
+
+uint64
+pagewalk(char *buf)
+{
+  uint64 sum = 0;
+
+  // each pass starts one cache line further into the page, so
+  // that it misses the TLB more than the data cache.
+  for(int pass = 0; pass < NPASS * 64; pass++)
+    for(int i = 0; i < SZ; i += PGSIZE)
+      sum += *(volatile uint64*)(buf + i + (pass % 64) * 64);
+  return sum;
+}
+
+void
+report(char *name, char *buf)
+{
+  uint64 t0, seq, walk;
+
+  memset(buf, 1, SZ);
+  t0 = uuptimens();
+  if(seqsum((uint64*)buf) != (uint64)NPASS * (SZ / sizeof(uint64)) * 0x0101010101010101ULL)
+    goto bad;
+  seq = uuptimens() - t0;
+  t0 = uuptimens();
+  if(pagewalk(buf) != (uint64)NPASS * 64 * (SZ / PGSIZE) * 0x0101010101010101ULL)
+    goto bad;
+  walk = uuptimens() - t0;
+  printf("%s\t%d ns/KB\t%d ns/page\n", name,
+         (int)(seq / (NPASS * (SZ / 1024))),
+         (int)(walk / (NPASS * 64 * (SZ / PGSIZE))));
+  return;
+
+bad:
+  fprintf(2, "memstream: %s: wrong sum\n", name);
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *small, *big;
+
+  if((small = smallpages()) == 0 || (big = bigpages()) == 0){
+    fprintf(2, "memstream: out of memory\n");
+    exit(1);
+  }
+  printf("mapping\tsequential\tpage stride\n");
+  report("4 KB", small);
+  report("2 MB", big);
+  exit(0);
+}
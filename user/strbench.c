@@ -0,0 +1,157 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+//
+// measure the throughput of the ulib.c string routines against
+// the byte-at-a-time loops they replaced, across sizes and
+// alignments. prints MB/s (bytes per microsecond).
+//
+
+#define MAXSZ   32768
+#define TOTAL   (4*1024*1024)   // bytes processed per measurement
+
+char a[MAXSZ + 16];
+char b[MAXSZ + 16];
+
+uint
+bytestrlen(const char *s)
+{
+  volatile const char *p = s;
+  int n;
+
+  for(n = 0; p[n]; n++)
+    ;
+  return n;
+}
+
+char*
+bytestrchr(const char *s, char c)
+{
+  volatile const char *p = s;
+
+  for(; *p; p++)
+    if(*p == c)
+      return (char*)p;
+  return 0;
+}
+
+void*
+bytememchr(const void *v, int c, uint n)
+{
+  volatile const uchar *s = v;
+
+  for(; n > 0; s++, n--)
+    if(*s == (uchar)c)
+      return (void*)s;
+  return 0;
+}
+
+void*
+bytememset(void *dst, int c, uint n)
+{
+  volatile char *cdst = (char *) dst;
+
+  for(int i = 0; i < n; i++)
+    cdst[i] = c;
+  return dst;
+}
+
+void*
+bytememmove(void *vdst, const void *vsrc, int n)
+{
+  volatile char *dst = vdst;
+  const char *src = vsrc;
+
+  while(n-- > 0)
+    *dst++ = *src++;
+  return vdst;
+}
+
+enum { STRLEN, STRCHR, MEMCHR, MEMSET, MEMMOVE, NOPS };
+
+char *names[] = {
+[STRLEN]  "strlen",
+[STRCHR]  "strchr",
+[MEMCHR]  "memchr",
+[MEMSET]  "memset",
+[MEMMOVE] "memmove",
+};
+
+// run op over n bytes at a+off until TOTAL bytes
+// have been processed; return the elapsed ns.
+uint64
+run(int op, int fast, int n, int off)
+{
+  char *s = a + off;
+  int rounds = TOTAL / n;
+  uint64 t0;
+
+  // a string of n non-nul bytes with no 'x' in it.
+  memset(a, 'a', sizeof(a));
+  s[n] = 0;
+
+  t0 = uuptimens();
+  for(int r = 0; r < rounds; r++){
+    switch(op){
+    case STRLEN:
+      if((fast ? strlen(s) : bytestrlen(s)) != n)
+        goto bad;
+      break;
+    case STRCHR:
+      if((fast ? strchr(s, 'x') : bytestrchr(s, 'x')) != 0)
+        goto bad;
+      break;
+    case MEMCHR:
+      if((fast ? memchr(s, 'x', n) : bytememchr(s, 'x', n)) != 0)
+        goto bad;
+      break;
+    case MEMSET:
+      if(fast)
+        memset(b + off, r, n);
+      else
+        bytememset(b + off, r, n);
+      break;
+    case MEMMOVE:
+      if(fast)
+        memmove(b + off, s, n);
+      else
+        bytememmove(b + off, s, n);
+      break;
+    }
+  }
+  return uuptimens() - t0;
+
+bad:
+  fprintf(2, "strbench: %s returned a wrong result\n", names[op]);
+  exit(1);
+}
+
+void
+report(int op, int n, int off)
+{
+  uint64 slow, fast, bytes;
+
+  bytes = (uint64)(TOTAL / n) * n;
+  slow = run(op, 0, n, off);
+  fast = run(op, 1, n, off);
+  if(slow == 0)
+    slow = 1;
+  if(fast == 0)
+    fast = 1;
+  printf("%s\t%d\t+%d\t%d MB/s\t%d MB/s\n", names[op], n, off,
+         (int)(bytes * 1000 / slow), (int)(bytes * 1000 / fast));
+}
+
+int
+main(int argc, char *argv[])
+{
+  static int sizes[] = { 8, 64, 512, 4096, MAXSZ };
+  static int offs[] = { 0, 1, 5 };
+
+  printf("routine\tsize\toffset\tbytes\tword\n");
+  for(int op = 0; op < NOPS; op++)
+    for(int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+      for(int j = 0; j < sizeof(offs)/sizeof(offs[0]); j++)
+        report(op, sizes[i], offs[j]);
+  exit(0);
+}
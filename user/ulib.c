@@ -1,8 +1,21 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
 #include "user/user.h"
 
+// the string and memory routines below work a uint64 at a time
+// where they can. strlen, strchr and memchr test eight bytes at
+// once for a nul or a match (SWAR). aligned loads never cross a
+// page, so reading a whole word past the end of a string is safe.
+
+#define WSIZE       ((int)sizeof(uint64))  // int, so that n >= WSIZE is false for n < 0
+#define WALIGNED(p) (((uint64)(p) & (WSIZE-1)) == 0)
+#define ONES        0x0101010101010101UL
+#define HIGHS       0x8080808080808080UL
+#define HASZERO(w)  (((w) - ONES) & ~(w) & HIGHS)
+
 //
 // wrapper so that it's OK if main() does not call exit().
 //
@@ -36,33 +49,81 @@ strcmp(const char *p, const char *q)
 uint
 strlen(const char *s)
 {
-  int n;
+  const char *p;
+  const uint64 *w;
 
-  for(n = 0; s[n]; n++)
+  for(p = s; !WALIGNED(p); p++)
+    if(*p == 0)
+      return p - s;
+  for(w = (const uint64 *) p; !HASZERO(*w); w++)
     ;
-  return n;
+  for(p = (const char *) w; *p; p++)
+    ;
+  return p - s;
 }
 
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uchar *cdst = (uchar *) dst;
+  uint64 *wdst, w;
+
+  while(n > 0 && !WALIGNED(cdst)){
+    *cdst++ = c;
+    n--;
+  }
+  w = (uchar)c * ONES;
+  wdst = (uint64 *) cdst;
+  for(; n >= 4*WSIZE; n -= 4*WSIZE, wdst += 4){
+    wdst[0] = w; wdst[1] = w; wdst[2] = w; wdst[3] = w;
   }
+  for(; n >= WSIZE; n -= WSIZE)
+    *wdst++ = w;
+  cdst = (uchar *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
 char*
 strchr(const char *s, char c)
 {
-  for(; *s; s++)
+  const uint64 *w;
+  uint64 mask = (uchar)c * ONES;
+
+  for(; !WALIGNED(s); s++){
+    if(*s == 0)
+      return 0;
+    if(*s == c)
+      return (char*)s;
+  }
+  // skip words with neither a nul nor c.
+  for(w = (const uint64 *) s; !HASZERO(*w) && !HASZERO(*w ^ mask); w++)
+    ;
+  for(s = (const char *) w; *s; s++)
     if(*s == c)
       return (char*)s;
   return 0;
 }
 
+void*
+memchr(const void *v, int c, uint n)
+{
+  const uchar *s = v;
+  const uint64 *w;
+  uint64 mask = (uchar)c * ONES;
+
+  for(; n > 0 && !WALIGNED(s); s++, n--)
+    if(*s == (uchar)c)
+      return (void*)s;
+  for(w = (const uint64 *) s; n >= WSIZE && !HASZERO(*w ^ mask); w++)
+    n -= WSIZE;
+  for(s = (const uchar *) w; n > 0; s++, n--)
+    if(*s == (uchar)c)
+      return (void*)s;
+  return 0;
+}
+
 char*
 gets(char *buf, int max)
 {
@@ -111,15 +172,50 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  uint64 *wdst;
+  const uint64 *wsrc;
+  int words;
 
+  if(n <= 0)
+    return vdst;
   dst = vdst;
   src = vsrc;
+  words = ((uint64)dst & (WSIZE-1)) == ((uint64)src & (WSIZE-1));
   if (src > dst) {
+    if(words){
+      for(; n > 0 && !WALIGNED(dst); n--)
+        *dst++ = *src++;
+      wdst = (uint64 *) dst;
+      wsrc = (const uint64 *) src;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, wdst += 4, wsrc += 4){
+        wdst[0] = wsrc[0]; wdst[1] = wsrc[1];
+        wdst[2] = wsrc[2]; wdst[3] = wsrc[3];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wdst++ = *wsrc++;
+      dst = (char *) wdst;
+      src = (const char *) wsrc;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(words){
+      for(; n > 0 && !WALIGNED(dst); n--)
+        *--dst = *--src;
+      wdst = (uint64 *) dst;
+      wsrc = (const uint64 *) src;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE){
+        wdst -= 4, wsrc -= 4;
+        wdst[3] = wsrc[3]; wdst[2] = wsrc[2];
+        wdst[1] = wsrc[1]; wdst[0] = wsrc[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wdst = *--wsrc;
+      dst = (char *) wdst;
+      src = (const char *) wsrc;
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -145,3 +241,37 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+//
+// fast paths that read the kernel's usyscall page
+// instead of trapping into the kernel.
+//
+
+int
+ugetpid(void)
+{
+  struct usyscall *u = (struct usyscall *)USYSCALL;
+  return u->pid;
+}
+
+static uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x) );
+  return x;
+}
+
+int
+uuptime(void)
+{
+  struct usyscall *u = (struct usyscall *)USYSCALL;
+  return rdtime() / u->tickcycles;
+}
+
+uint64
+uuptimens(void)
+{
+  struct usyscall *u = (struct usyscall *)USYSCALL;
+  return rdtime() * (1000000000L / u->timebase);
+}
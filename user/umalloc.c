@@ -3,6 +3,18 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
+// Small requests are served from segregated free lists, one
+// per power-of-two size class, so malloc and free of a small
+// object are O(1) and never search. Objects of a class are
+// carved from slabs that come from the allocator below, which
+// also serves requests too large for any class.
+//
+// Every block is preceded by a Tag recording its class (or
+// TAGLARGE) and the number of bytes requested, which free()
+// uses to find the block's list and mallocstats() uses to
+// report fragmentation. The tag takes TAGSIZE bytes so that
+// blocks stay 16-byte aligned, as the RISC-V psABI expects.
+
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
 
@@ -21,8 +33,8 @@ typedef union header Header;
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+static void
+kr_free(void *ap)
 {
   Header *bp, *p;
 
@@ -56,12 +68,12 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  kr_free((void*)(hp + 1));
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+kr_malloc(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
@@ -88,3 +100,142 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+// Size classes.
+
+#define NCLASS    8          // classes of 16, 32, ..., 2048 bytes
+#define MINCLASS  16
+#define MAXCLASS  (MINCLASS << (NCLASS-1))
+#define SLABSIZE  4096       // minimum bytes carved at a time
+#define TAGLARGE  NCLASS     // class of a block from kr_malloc()
+
+typedef uint64 Tag;          // class in the low 8 bits, then bytes requested
+
+#define TAGSIZE       16     // bytes before each block: the Tag and padding
+#define TAG(c, n)     ((c) | ((Tag)(n) << 8))
+#define TAGCLASS(t)   ((t) & 0xff)
+#define TAGBYTES(t)   ((t) >> 8)
+
+struct freeobj {
+  struct freeobj *next;
+};
+
+static struct freeobj *freelist[NCLASS];
+
+static struct {
+  uint nslab;     // slabs carved into this class
+  uint nobj;      // objects carved
+  uint nalloc;    // objects in use
+  uint64 req;     // bytes requested by the objects in use
+} cstats[NCLASS];
+
+static uint nlarge;       // large blocks in use
+static uint64 largereq;   // bytes requested by them
+
+// carve a new slab into objects of class c.
+static int
+refill(int c)
+{
+  uint size = MINCLASS << c;
+  uint n = size * 8 < SLABSIZE ? SLABSIZE : size * 8;
+  char *slab, *p;
+
+  // kr_malloc() adds a Header; ask for exactly n bytes in all.
+  if((slab = kr_malloc(n - sizeof(Header))) == 0)
+    return -1;
+  for(p = slab; p + size <= slab + n - sizeof(Header); p += size){
+    ((struct freeobj*)p)->next = freelist[c];
+    freelist[c] = (struct freeobj*)p;
+    cstats[c].nobj++;
+  }
+  cstats[c].nslab++;
+  return 0;
+}
+
+void*
+malloc(uint nbytes)
+{
+  Tag *t;
+  uint need;
+  int c;
+
+  need = nbytes + TAGSIZE;
+  if(need < nbytes)
+    return 0;
+  if(need > MAXCLASS){
+    if((t = kr_malloc(need)) == 0)
+      return 0;
+    *t = TAG(TAGLARGE, nbytes);
+    nlarge++;
+    largereq += nbytes;
+    return (char*)t + TAGSIZE;
+  }
+
+  for(c = 0; (MINCLASS << c) < need; c++)
+    ;
+  if(freelist[c] == 0 && refill(c) < 0)
+    return 0;
+  t = (Tag*)freelist[c];
+  freelist[c] = freelist[c]->next;
+  *t = TAG(c, nbytes);
+  cstats[c].nalloc++;
+  cstats[c].req += nbytes;
+  return (char*)t + TAGSIZE;
+}
+
+void
+free(void *ap)
+{
+  Tag *t;
+  int c;
+
+  if(ap == 0)
+    return;
+  t = (Tag*)((char*)ap - TAGSIZE);
+  c = TAGCLASS(*t);
+  if(c == TAGLARGE){
+    nlarge--;
+    largereq -= TAGBYTES(*t);
+    kr_free(t);
+    return;
+  }
+  cstats[c].nalloc--;
+  cstats[c].req -= TAGBYTES(*t);
+  ((struct freeobj*)t)->next = freelist[c];
+  freelist[c] = (struct freeobj*)t;
+}
+
+// print per-class usage and fragmentation to fd:
+// internal (bytes of in-use objects beyond what was requested)
+// and external (free space left in the large-block free list).
+void
+mallocstats(int fd)
+{
+  uint64 slotbytes, nfree, freebytes;
+  Header *p;
+
+  fprintf(fd, "class\tslabs\tinuse\tfree\trequested\twasted\n");
+  for(int c = 0; c < NCLASS; c++){
+    if(cstats[c].nslab == 0)
+      continue;
+    slotbytes = (uint64)cstats[c].nalloc * (MINCLASS << c);
+    fprintf(fd, "%d\t%d\t%d\t%d\t%ld\t%ld\n", MINCLASS << c,
+            cstats[c].nslab, cstats[c].nalloc,
+            cstats[c].nobj - cstats[c].nalloc,
+            cstats[c].req, slotbytes - cstats[c].req);
+  }
+
+  nfree = freebytes = 0;
+  if(freep){
+    p = freep;
+    do {
+      if(p->s.size > 0){
+        nfree++;
+        freebytes += p->s.size * sizeof(Header);
+      }
+      p = p->s.ptr;
+    } while(p != freep);
+  }
+  fprintf(fd, "large\t%d in use, %ld bytes requested\n", nlarge, largereq);
+  fprintf(fd, "free\t%ld bytes in %ld fragments\n", freebytes, nfree);
+}
@@ -1,4 +1,5 @@
 struct stat;
+struct ioring;
 
 // system calls
 int fork(void);
@@ -22,12 +23,17 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+uint64 uptimens(void);
+int ioenter(struct ioring*, int);
+int fsync(int);
+int fdatasync(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
+void* memchr(const void*, int, uint);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...) __attribute__ ((format (printf, 2, 3)));
 void printf(const char*, ...) __attribute__ ((format (printf, 1, 2)));
@@ -37,7 +43,11 @@ void* memset(void*, int, uint);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int ugetpid(void);
+int uuptime(void);
+uint64 uuptimens(void);
 
 // umalloc.c
 void* malloc(uint);
 void free(void*);
+void mallocstats(int);
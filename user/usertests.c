@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/ioring.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2586,6 +2587,341 @@ badarg(char *s)
   exit(0);
 }
 
+// uptime() and uptimens() are read from the time CSR without
+// a lock; check that they are monotonic and agree with sleep().
+void
+uptimetest(char *s)
+{
+  uint64 ns0, ns1;
+  int t0, t1;
+
+  t0 = uptime();
+  ns0 = uptimens();
+  for(int i = 0; i < 1000; i++){
+    ns1 = uptimens();
+    if(ns1 < ns0){
+      printf("%s: uptimens went backwards\n", s);
+      exit(1);
+    }
+    ns0 = ns1;
+  }
+  if(sleep(2) < 0){
+    printf("%s: sleep failed\n", s);
+    exit(1);
+  }
+  t1 = uptime();
+  if(t1 - t0 < 2){
+    printf("%s: sleep(2) returned after %d ticks\n", s, t1 - t0);
+    exit(1);
+  }
+  if(uptimens() <= ns0){
+    printf("%s: uptimens did not advance across sleep\n", s);
+    exit(1);
+  }
+}
+
+// the usyscall page must agree with the real system calls,
+// including in a forked child, and must not be writable.
+void
+usyscalltest(char *s)
+{
+  int pid, xstatus;
+
+  if(ugetpid() != getpid()){
+    printf("%s: ugetpid %d != getpid %d\n", s, ugetpid(), getpid());
+    exit(1);
+  }
+  if(uuptime() - uptime() > 1 || uptime() - uuptime() > 1){
+    printf("%s: uuptime %d != uptime %d\n", s, uuptime(), uptime());
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    exit(ugetpid() == getpid() ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: ugetpid wrong in child\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    *(volatile int *)USYSCALL = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: usyscall page is writable\n", s);
+    exit(1);
+  }
+}
+
+// open, write, close, open, read, fstat and close a file
+// through one ioenter() call.
+void
+ioringtest(char *s)
+{
+  static struct ioring r;
+  static char name[] = "ioring0";
+  static char out[] = "hello ioring";
+  static char in[sizeof(out)];
+  struct stat st;
+  struct iosqe *sqe;
+  int fd, i;
+
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+
+  sqe = &r.sq[r.sqtail++ % IORING_NENT];
+  *sqe = (struct iosqe){ SYS_write, 0, { fd, (uint64)out, sizeof(out) }, 1 };
+  sqe = &r.sq[r.sqtail++ % IORING_NENT];
+  *sqe = (struct iosqe){ SYS_close, 0, { fd }, 2 };
+  sqe = &r.sq[r.sqtail++ % IORING_NENT];
+  *sqe = (struct iosqe){ SYS_open, 0, { (uint64)name, O_RDONLY }, 3 };
+  if(ioenter(&r, IORING_NENT) != 3 || r.sqhead != 3 || r.cqtail != 3){
+    printf("%s: ioenter did not run 3 entries\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3; i++){
+    if(r.cq[i].user_data != i + 1 || r.cq[i].res < 0){
+      printf("%s: entry %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  fd = r.cq[2].res;
+  r.cqhead = 3;
+
+  sqe = &r.sq[r.sqtail++ % IORING_NENT];
+  *sqe = (struct iosqe){ SYS_read, 0, { fd, (uint64)in, sizeof(in) }, 4 };
+  sqe = &r.sq[r.sqtail++ % IORING_NENT];
+  *sqe = (struct iosqe){ SYS_fstat, 0, { fd, (uint64)&st }, 5 };
+  sqe = &r.sq[r.sqtail++ % IORING_NENT];
+  *sqe = (struct iosqe){ SYS_close, 0, { fd }, 6 };
+  sqe = &r.sq[r.sqtail++ % IORING_NENT];
+  *sqe = (struct iosqe){ SYS_fork, 0, { 0 }, 7 };
+  if(ioenter(&r, IORING_NENT) != 4){
+    printf("%s: ioenter did not run 4 entries\n", s);
+    exit(1);
+  }
+  if(r.cq[3].res != sizeof(out) || strcmp(in, out) != 0 ||
+     r.cq[4].res != 0 || st.size != sizeof(out) || r.cq[5].res != 0){
+    printf("%s: wrong read/fstat/close results\n", s);
+    exit(1);
+  }
+  if(r.cq[6].res != -1){
+    printf("%s: ioenter ran fork\n", s);
+    exit(1);
+  }
+  unlink(name);
+}
+
+// small objects of many sizes must not overlap, and
+// a freed object is reused by the next request of its class.
+void
+malloctest(char *s)
+{
+  enum { N = 500 };
+  static char *p[N];
+  char *q;
+  int i, j;
+
+  for(i = 0; i < N; i++){
+    if((p[i] = malloc(i * 7 % 3000)) == 0){
+      printf("%s: malloc failed\n", s);
+      exit(1);
+    }
+    if(((uint64)p[i] & 15) != 0){
+      printf("%s: malloc returned %p, not 16-byte aligned\n", s, p[i]);
+      exit(1);
+    }
+    memset(p[i], i, i * 7 % 3000);
+  }
+  for(i = 0; i < N; i++){
+    for(j = 0; j < i * 7 % 3000; j++){
+      if(p[i][j] != (char)i){
+        printf("%s: object %d overwritten\n", s, i);
+        exit(1);
+      }
+    }
+  }
+  q = p[N-1];
+  free(q);
+  if(malloc((N-1) * 7 % 3000) != q){
+    printf("%s: freed object not reused\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    free(p[i]);
+  free(0);
+}
+
+// grow the heap enough to get 2 MB superpages, then check that
+// fork, system calls, and a shrink that splits one of them
+// all see the right memory.
+void
+superpagetest(char *s)
+{
+  enum { MEGA = 2*1024*1024, SZ = 3*MEGA };
+  char *old, *a, *top;
+  int fds[2], pid, xstatus;
+  uint64 i;
+
+  old = sbrk(0);
+  if(sbrk(SZ + MEGA) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = (char*)(((uint64)old + MEGA - 1) & ~(uint64)(MEGA - 1));
+  for(i = 0; i < SZ; i += PGSIZE)
+    *(uint64*)(a + i) = i;
+
+  // copyout() into and copyin() out of the middle of a superpage.
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  memset(a + MEGA + 8, 'x', 32);
+  if(write(fds[1], a + MEGA + 8, 32) != 32 ||
+     read(fds[0], a + MEGA + PGSIZE + 8, 32) != 32 ||
+     memcmp(a + MEGA + 8, a + MEGA + PGSIZE + 8, 32) != 0){
+    printf("%s: pipe copy wrong\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < SZ; i += PGSIZE){
+      if(*(uint64*)(a + i) != i)
+        exit(1);
+      *(uint64*)(a + i) = 0;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong memory\n", s);
+    exit(1);
+  }
+
+  // cut into the last superpage, then grow back.
+  top = sbrk(0);
+  if(sbrk(-(MEGA + 3*PGSIZE)) == (char*)-1){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ && a + i < top - (MEGA + 3*PGSIZE); i += PGSIZE){
+    if(*(uint64*)(a + i) != i){
+      printf("%s: page %d changed\n", s, (int)(i / PGSIZE));
+      exit(1);
+    }
+  }
+  if(sbrk(MEGA + 3*PGSIZE) == (char*)-1){
+    printf("%s: sbrk regrow failed\n", s);
+    exit(1);
+  }
+  for(i = (uint64)(top - (MEGA + 3*PGSIZE)); i < (uint64)top; i += PGSIZE){
+    if(*(uint64*)i != 0){
+      printf("%s: regrown memory not zero\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-(top - old));
+}
+
+// fsync and fdatasync succeed on files and directories,
+// fail on pipes and bad descriptors, and leave data intact.
+void
+fsynctest(char *s)
+{
+  int fd, fds[2], i, pid;
+  char buf[8];
+
+  unlink("fsyncfile");
+  fd = open("fsyncfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create fsyncfile failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "fsync", 5) != 5 || fsync(fd) != 0 || fdatasync(fd) != 0){
+    printf("%s: fsync of file failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open(".", O_RDONLY);
+  if(fsync(fd) != 0){
+    printf("%s: fsync of directory failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fsync(fds[0]) != -1 || fdatasync(fds[1]) != -1 || fsync(-1) != -1 || fsync(NOFILE) != -1){
+    printf("%s: fsync of pipe or bad fd succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  fd = open("fsyncfile", O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != 5 || memcmp(buf, "fsync", 5) != 0){
+    printf("%s: fsyncfile has wrong contents\n", s);
+    exit(1);
+  }
+
+  // fsync must return while another process keeps
+  // the log busy, rather than wait for a quiet moment.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(;;){
+      int wfd = open("fsyncbusy", O_CREATE|O_WRONLY);
+      if(wfd >= 0){
+        write(wfd, "busy", 4);
+        close(wfd);
+      }
+      unlink("fsyncbusy");
+    }
+  }
+  for(i = 0; i < 20; i++){
+    if(fsync(fd) != 0){
+      printf("%s: fsync under load failed\n", s);
+      exit(1);
+    }
+  }
+  kill(pid);
+  wait(0);
+  close(fd);
+  unlink("fsyncbusy");
+  unlink("fsyncfile");
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2650,6 +2986,12 @@ struct test {
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {uptimetest, "uptimetest"},
+  {usyscalltest, "usyscall"},
+  {ioringtest, "ioring"},
+  {malloctest, "malloctest"},
+  {superpagetest, "superpagetest"},
+  {fsynctest, "fsynctest"},
 
   { 0, 0},
 };
@@ -2852,7 +3194,7 @@ diskfull(char *s)
       break;
     }
     for(int i = 0; i < MAXFILE; i++){
-      char buf[BSIZE];
+      static char buf[BSIZE];  // a 4 KB BSIZE won't fit on the stack
       if(write(fd, buf, BSIZE) != BSIZE){
         done = 1;
         close(fd);
@@ -36,3 +36,7 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("uptimens");
+entry("ioenter");
+entry("fsync");
+entry("fdatasync");